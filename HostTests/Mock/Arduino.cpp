@@ -0,0 +1,51 @@
+// 
+//  Arduino.cpp
+// 
+// (c) Mark Naylor June 2021
+//
+// PC versions of the Arduino core routines and registers declared in Arduino.h. Pins are mapped as on the Uno, digitalRead always
+// reads LOW and Serial writes to stdout
+
+#include <Arduino.h>
+#include <stdio.h>
+
+// registers, interrupts can't happen on the PC so turning them off does nothing, the time is set by the test
+#define R(n) volatile uint8_t n;
+#define R16(n) volatile uint16_t n;
+R(SREG) R(TCCR2A) R(TCCR2B) R(TCNT2) R(OCR2A) R(OCR2B) R(TIMSK2) W1C TIFR2; R(ASSR) R(GTCCR)
+R(TCCR1A) R(TCCR1B) R(TCCR1C) R16(TCNT1) R16(OCR1A) R16(OCR1B) R(TIMSK1) W1C TIFR1; R16(ICR1)
+R(TCCR0A) R(TCCR0B) R(TCNT0) R(OCR0A) R(OCR0B) R(TIMSK0) W1C TIFR0;
+R(PCICR) R(PCMSK0) R(PCMSK1) R(PCMSK2) W1C PCIFR; R(EICRA) R(EIMSK) W1C EIFR;
+R(PORTB) R(PORTC) R(PORTD) R(PINB) R(PINC) R(PIND) R(DDRB) R(DDRC) R(DDRD)
+R(SPCR) R(SPSR) R(SPDR) R(PRR)
+void noInterrupts(){} void interrupts(){} void cli(){} void sei(){}
+unsigned long g_ms, g_us; unsigned long millis(){return g_ms;} unsigned long micros(){return g_us;}
+void pinMode(uint8_t, uint8_t){} void digitalWrite(uint8_t, uint8_t){} int digitalRead(uint8_t){return 0;}
+
+// Uno pin mapping
+static uint8_t port(uint8_t p){ return p<8?4: p<14?2: p<20?3:0; }
+static uint8_t pbit(uint8_t p){ return p<8?p: p<14?p-8: p-14; }
+uint8_t digitalPinToPort(uint8_t p){return port(p);}
+uint8_t digitalPinToBitMask(uint8_t p){return 1<<pbit(p);}
+uint8_t digitalPinToTimer(uint8_t){return 0;}
+volatile uint8_t* portInputRegister(uint8_t p){return p==2?&PINB:p==3?&PINC:&PIND;}
+volatile uint8_t* portOutputRegister(uint8_t p){return p==2?&PORTB:p==3?&PORTC:&PORTD;}
+volatile uint8_t* portModeRegister(uint8_t p){return p==2?&DDRB:p==3?&DDRC:&DDRD;}
+volatile uint8_t* digitalPinToPCMSK(uint8_t p){return p<8?&PCMSK2:p<14?&PCMSK0:p<20?&PCMSK1:0;}
+uint8_t digitalPinToPCMSKbit(uint8_t p){return pbit(p);}
+volatile uint8_t* digitalPinToPCICR(uint8_t p){return p<20?&PCICR:0;}
+uint8_t digitalPinToPCICRbit(uint8_t p){return p<8?2:p<14?0:1;}
+int digitalPinToInterrupt(uint8_t p){return p==2?0:p==3?1:-1;}
+
+// Serial
+HardwareSerial Serial;
+static void pn(unsigned long v,int b){ if(b==2){char s[40];int i=0; if(!v)s[i++]='0'; while(v){s[i++]='0'+(v&1);v>>=1;} while(i)putchar(s[--i]);} else printf(b==16?"%lx":"%lu",v);}
+void HardwareSerial::begin(unsigned long){} int HardwareSerial::available(){return 0;} int HardwareSerial::read(){return -1;} HardwareSerial::operator bool(){return true;}
+size_t HardwareSerial::print(const char*s){return printf("%s",s);} size_t HardwareSerial::print(const __FlashStringHelper*s){return printf("%s",(const char*)s);}
+size_t HardwareSerial::print(const String&){return 0;} size_t HardwareSerial::print(char c){putchar(c);return 1;}
+size_t HardwareSerial::print(int v,int b){ if(v<0&&b==10){putchar('-');v=-v;} pn(v,b);return 1;} size_t HardwareSerial::print(unsigned int v,int b){pn(v,b);return 1;}
+size_t HardwareSerial::print(long v,int b){ if(v<0&&b==10){putchar('-');v=-v;} pn(v,b);return 1;} size_t HardwareSerial::print(unsigned long v,int b){pn(v,b);return 1;}
+size_t HardwareSerial::print(unsigned char v,int b){pn(v,b);return 1;} size_t HardwareSerial::print(double v,int d){return printf("%.*f",d,v);}
+size_t HardwareSerial::println(){putchar('\n');return 1;} size_t HardwareSerial::println(const char*s){return printf("%s\n",s);} size_t HardwareSerial::println(const __FlashStringHelper*s){return printf("%s\n",(const char*)s);}
+size_t HardwareSerial::println(int v,int b){print(v,b);return println();} size_t HardwareSerial::println(unsigned long v,int b){print(v,b);return println();}
+size_t HardwareSerial::println(unsigned int v,int b){print(v,b);return println();} size_t HardwareSerial::println(long v,int b){print(v,b);return println();}
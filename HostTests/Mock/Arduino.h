@@ -0,0 +1,78 @@
+// 
+//  Arduino.h
+// 
+// (c) Mark Naylor June 2021
+//
+// Just enough of the Arduino core and the ATmega328P registers to build the oiler on a PC for the tests in HostTests. Registers are
+// plain variables, a test moves the timers on itself and calls the routines their interrupts would. Interrupt flag registers are
+// cleared by writing a 1, as on the chip
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <new>
+
+typedef uint8_t byte;
+typedef bool boolean;
+#define F_CPU 16000000UL
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define NOT_A_PIN 0
+#define NOT_A_PORT 0
+#define NOT_AN_INTERRUPT -1
+#define PB 2
+#define PC 3
+#define PD 4
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define _BV(b) (1<<(b))
+#define bit(b) (1UL<<(b))
+#define ISR(v) extern "C" void v(void); void v(void)
+#define REG(n) extern volatile uint8_t n;
+#define REG16(n) extern volatile uint16_t n;
+struct W1C { volatile uint8_t v; W1C& operator=(uint8_t x){v&=~x;return *this;} operator uint8_t() const {return v;} void set(uint8_t x){v|=x;} };
+#define REGW(n) extern W1C n;
+REG(SREG) REG(TCCR2A) REG(TCCR2B) REG(TCNT2) REG(OCR2A) REG(OCR2B) REG(TIMSK2) REGW(TIFR2) REG(ASSR) REG(GTCCR)
+#define SREG_I 7
+#define BIN 2
+#define HEX 16
+#define DEC 10
+REG(TCCR1A) REG(TCCR1B) REG(TCCR1C) REG16(TCNT1) REG16(OCR1A) REG16(OCR1B) REG(TIMSK1) REGW(TIFR1) REG16(ICR1)
+REG(TCCR0A) REG(TCCR0B) REG(TCNT0) REG(OCR0A) REG(OCR0B) REG(TIMSK0) REGW(TIFR0)
+REG(PCICR) REG(PCMSK0) REG(PCMSK1) REG(PCMSK2) REGW(PCIFR) REG(EICRA) REG(EIMSK) REGW(EIFR)
+REG(PORTB) REG(PORTC) REG(PORTD) REG(PINB) REG(PINC) REG(PIND) REG(DDRB) REG(DDRC) REG(DDRD)
+REG(SPCR) REG(SPSR) REG(SPDR) REG(PRR)
+enum { WGM20, WGM21, WGM22=3, CS20=0, CS21, CS22, OCIE2A=1, OCIE2B=2, TOIE2=0, OCF2A=1, OCF2B=2, TOV2=0,
+ WGM10=0, WGM11, WGM12=3, WGM13, CS10=0, CS11, CS12, OCIE1A=1, OCIE1B=2, TOIE1=0, OCF1A=1, OCF1B=2, TOV1=0, COM1A0=6, COM1A1=7, COM1B0=4, COM1B1=5, FOC1A=7, FOC1B=6,
+ COM0A1=7, COM0B1=5, COM2A1=7, COM2B1=5,
+ ISC00=0, ISC01, ISC10, ISC11, INT0=0, INT1, INTF0=0, INTF1, PCIE0=0, PCIE1, PCIE2, PCIF0=0, PCIF1, PCIF2,
+ SPE=6, MSTR=4, SPIF=7, SPI2X=0, SPR0=0, SPR1=1, CPOL=3, CPHA=2, DORD=5, PRTIM1=3, PRTIM2=6 };
+void pinMode(uint8_t, uint8_t); void digitalWrite(uint8_t, uint8_t); int digitalRead(uint8_t);
+void analogWrite(uint8_t, int);
+unsigned long millis(); unsigned long micros(); void delay(unsigned long); void delayMicroseconds(unsigned int);
+void noInterrupts(); void interrupts(); void cli(); void sei();
+uint8_t digitalPinToPort(uint8_t); uint8_t digitalPinToBitMask(uint8_t); uint8_t digitalPinToTimer(uint8_t);
+volatile uint8_t* portInputRegister(uint8_t); volatile uint8_t* portOutputRegister(uint8_t); volatile uint8_t* portModeRegister(uint8_t);
+volatile uint8_t* digitalPinToPCMSK(uint8_t); uint8_t digitalPinToPCMSKbit(uint8_t); volatile uint8_t* digitalPinToPCICR(uint8_t); uint8_t digitalPinToPCICRbit(uint8_t);
+int digitalPinToInterrupt(uint8_t);
+#define NUM_DIGITAL_PINS 20
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper*)(s))
+class String { public: String(const char* = ""); String(const __FlashStringHelper*); String(int); String(unsigned int); String(long); String(unsigned long); String(double, unsigned char = 2);
+ String& operator+=(const String&); friend String operator+(const String&, const String&); friend String operator+(const String&, const char*); friend String operator+(const String&, int); friend String operator+(const String&, unsigned char);};
+class HardwareSerial { public: void begin(unsigned long); int available(); int read(); operator bool();
+ size_t print(const char*); size_t print(const __FlashStringHelper*); size_t print(const String&); size_t print(char); size_t print(int, int=10); size_t print(unsigned int, int=10); size_t print(long, int=10); size_t print(unsigned long, int=10); size_t print(unsigned char, int=10); size_t print(double, int=2);
+ size_t println(); size_t println(const char*); size_t println(const __FlashStringHelper*); size_t println(int, int=10); size_t println(unsigned long, int=10); size_t println(unsigned int, int=10); size_t println(long, int=10); };
+extern HardwareSerial Serial;
+#define SS 10
+#define MOSI 11
+#define MISO 12
+#define SCK 13
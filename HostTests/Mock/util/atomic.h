@@ -0,0 +1,3 @@
+#pragma once
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(x) for(int _i=0;_i<1;_i++)
@@ -0,0 +1,141 @@
+// 
+//  OilerStatesTest.cpp
+// 
+// (c) Mark Naylor June 2021
+//
+// Walks every state and event of the oiler's transition table. Each pair is looked up with GetOilerTransition and then handled by
+// TheOiler, which must end in the expected state and count the transition, or count the event as refused if its action refused it.
+// One relay motor is used as it stops the moment it is turned off, in ON_TIME mode so machine ready events are always refused
+
+#define protected public
+#include "Oiler.h"
+#include "WorkQueue.h"
+#include <stdio.h>
+
+typedef struct
+{
+	uint8_t		uiNextState;						// eOilerState, as in the table
+	uint8_t		uiAction;							// eOilerAction, as in the table
+	uint8_t		uiEndState;							// eOilerState TheOiler is in after the event
+	bool		bRefused;							// the action refuses the event in this test
+} EXPECTED;
+
+const EXPECTED Expected [ NUM_OILER_STATES ][ NUM_OILER_EVENTS ] =
+{
+	// OILER_OILING, the motor is running
+	{
+		{ OILER_OILING,	OILER_START_MOTORS,		OILER_OILING,	false	},		// OILER_START
+		{ OILER_OFF,	OILER_STOP_MOTORS,		OILER_OFF,		false	},		// OILER_STOP
+		{ OILER_OILING,	OILER_COUNT_WORK,		OILER_OILING,	false	},		// OILER_MOTOR_WORK, one drip of three
+		{ OILER_IDLE,	OILER_REST,				OILER_OILING,	true	},		// OILER_MOTORS_DONE
+		{ OILER_OILING,	OILER_NO_ACTION,		OILER_OILING,	false	},		// OILER_MOTOR_STARTED
+		{ OILER_OILING,	OILER_SERVE_DEADLINES,	OILER_OILING,	false	},		// OILER_DEADLINE
+		{ OILER_OILING,	OILER_OIL_LATE,			OILER_OILING,	true	},		// OILER_MACHINE_READY
+		{ OILER_IDLE,	OILER_REST,				OILER_OILING,	true	}		// OILER_MOTOR_STOPPED
+	},
+	// OILER_OFF
+	{
+		{ OILER_OILING,	OILER_START_MOTORS,		OILER_OILING,	false	},		// OILER_START
+		{ OILER_OFF,	OILER_NO_ACTION,		OILER_OFF,		false	},		// OILER_STOP
+		{ OILER_OFF,	OILER_COUNT_WORK,		OILER_OFF,		false	},		// OILER_MOTOR_WORK
+		{ OILER_OFF,	OILER_NO_ACTION,		OILER_OFF,		false	},		// OILER_MOTORS_DONE
+		{ OILER_OFF,	OILER_NO_ACTION,		OILER_OFF,		false	},		// OILER_MOTOR_STARTED
+		{ OILER_OFF,	OILER_NO_ACTION,		OILER_OFF,		false	},		// OILER_DEADLINE
+		{ OILER_OFF,	OILER_NO_ACTION,		OILER_OFF,		false	},		// OILER_MACHINE_READY
+		{ OILER_OFF,	OILER_NO_ACTION,		OILER_OFF,		false	}		// OILER_MOTOR_STOPPED
+	},
+	// OILER_IDLE, the motor has stopped
+	{
+		{ OILER_OILING,	OILER_START_MOTORS,		OILER_OILING,	false	},		// OILER_START
+		{ OILER_OFF,	OILER_STOP_MOTORS,		OILER_OFF,		false	},		// OILER_STOP
+		{ OILER_IDLE,	OILER_COUNT_WORK,		OILER_IDLE,		false	},		// OILER_MOTOR_WORK
+		{ OILER_IDLE,	OILER_NO_ACTION,		OILER_IDLE,		false	},		// OILER_MOTORS_DONE
+		{ OILER_OILING,	OILER_NO_ACTION,		OILER_OILING,	false	},		// OILER_MOTOR_STARTED
+		{ OILER_IDLE,	OILER_SERVE_DEADLINES,	OILER_IDLE,		false	},		// OILER_DEADLINE
+		{ OILER_OILING,	OILER_OIL_MACHINE,		OILER_IDLE,		true	},		// OILER_MACHINE_READY
+		{ OILER_IDLE,	OILER_NO_ACTION,		OILER_IDLE,		false	}		// OILER_MOTOR_STOPPED
+	}
+};
+
+uint16_t uiChecks = 0;
+uint16_t uiFailed = 0;
+
+void Check ( bool bPassed, const char* pszWhat, uint8_t uiState, uint8_t uiEvent )
+{
+	uiChecks++;
+	if ( !bPassed )
+	{
+		uiFailed++;
+		printf ( "FAILED %s, state %d event %d\n", pszWhat, uiState, uiEvent );
+	}
+}
+
+void HandleEvent ( uint8_t uiEvent, uint8_t uiParam )
+{
+	TheOiler.HandleEvent ( uiEvent, uiParam );
+	while ( TheWorkQueue.Dispatch () );
+}
+
+// get TheOiler into a state the way it would get there when running
+void GoToState ( uint8_t uiState )
+{
+	TheOiler.Off ();
+	if ( uiState != OILER_OFF )
+	{
+		TheOiler.On ();
+		if ( uiState == OILER_IDLE )
+		{
+			for ( uint8_t i = 0; i < 3; i++ )
+			{
+				HandleEvent ( OILER_MOTOR_WORK, 0 );
+			}
+		}
+	}
+	while ( TheWorkQueue.Dispatch () );
+}
+
+// handle one event in the state TheOiler is in and check where it went and what was counted
+void CheckEvent ( uint8_t uiState, uint8_t uiEvent, uint8_t uiEndState, bool bRefused )
+{
+	Check ( TheOiler.GetStatus () == uiState, "start state", uiState, uiEvent );
+
+	uint16_t uiTaken = TheOiler.GetTransitionCount ( uiState, uiEvent );
+	uint16_t uiRefused = TheOiler.GetRefusedCount ();
+
+	HandleEvent ( uiEvent, 0 );
+	Check ( TheOiler.GetStatus () == uiEndState, "end state", uiState, uiEvent );
+	Check ( TheOiler.GetTransitionCount ( uiState, uiEvent ) == uiTaken + ( bRefused ? 0 : 1 ), "transition count", uiState, uiEvent );
+	Check ( TheOiler.GetRefusedCount () == uiRefused + ( bRefused ? 1 : 0 ), "refused count", uiState, uiEvent );
+}
+
+int main ( void )
+{
+	OILER_TRANSITION Transition;
+
+	TheOiler.AddMotor ( 4, 14, 3 );
+	TheOiler.SetStartMode ( OilerClass::ON_TIME, TIME_BETWEEN_OILING );
+
+	for ( uint8_t uiState = 0; uiState < NUM_OILER_STATES; uiState++ )
+	{
+		for ( uint8_t uiEvent = 0; uiEvent < NUM_OILER_EVENTS; uiEvent++ )
+		{
+			const EXPECTED* pExpected = &Expected [ uiState ][ uiEvent ];
+
+			Check ( GetOilerTransition ( uiState, uiEvent, &Transition ), "lookup", uiState, uiEvent );
+			Check ( Transition.uiNextState == pExpected->uiNextState, "table next state", uiState, uiEvent );
+			Check ( Transition.uiAction == pExpected->uiAction, "table action", uiState, uiEvent );
+			GoToState ( uiState );
+			CheckEvent ( uiState, uiEvent, pExpected->uiEndState, pExpected->bRefused );
+		}
+	}
+	Check ( !GetOilerTransition ( NUM_OILER_STATES, 0, &Transition ), "state out of range", NUM_OILER_STATES, 0 );
+	Check ( !GetOilerTransition ( 0, NUM_OILER_EVENTS, &Transition ), "event out of range", 0, NUM_OILER_EVENTS );
+
+	// a motor that was still slowing down when it reached its target stops later, that leaves the oiler idle
+	GoToState ( OILER_OILING );
+	TheMotors.Off ( TheOiler.m_Motors.MotorInfo [ 0 ].uiMotor );
+	CheckEvent ( OILER_OILING, OILER_MOTOR_STOPPED, OILER_IDLE, false );
+
+	printf ( "OilerStatesTest: %u checks, %u failed\n", uiChecks, uiFailed );
+	return uiFailed == 0 ? 0 : 1;
+}
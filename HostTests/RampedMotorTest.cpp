@@ -0,0 +1,110 @@
+// 
+//  RampedMotorTest.cpp
+// 
+// (c) Mark Naylor June 2021
+//
+// A stepper with a ramp is still slowing down when it reaches its drip target, it stops later in its timer interrupt. The oiler must still
+// go idle when the last motor does, and in a machine mode oil again when the machine is next ready without counting it as a late oiling.
+// Motor 0 is a four pin stepper, its step engine callback is called directly, motor 1 is a STEP / DIR stepper driven by a stand in for
+// Timer1's counter and compare match. Each takes a turn at being the last to stop
+
+#define protected public
+#include "Oiler.h"
+#include "WorkQueue.h"
+#include <stdio.h>
+
+#define		MAX_STEP_TICKS		100000UL			// step engine ticks allowed for the motor to stop, 10s
+
+uint16_t uiChecks = 0;
+uint16_t uiFailed = 0;
+
+void Check ( bool bPassed, const char* pszWhat )
+{
+	uiChecks++;
+	if ( !bPassed )
+	{
+		uiFailed++;
+		printf ( "FAILED %s\n", pszWhat );
+	}
+}
+
+void MotorWorkHandler ( uint8_t uiMotorIndex );
+
+// what the timer interrupts and loop would do in one step engine tick, Timer1 counts 200 times at 0.5us
+void StepTick ( void )
+{
+	StepEngineClass::Tick ( &TheStepEngine );
+	FourPinStepperMotorClass::FlushPorts ();
+	for ( uint8_t i = 0; i < 200; i++ )
+	{
+		TCNT1++;
+		if ( ( TIMSK1 & ( 1 << OCIE1B ) ) && TCNT1 == OCR1B )
+		{
+			StepDirMotorClass::CompareB ();
+		}
+	}
+	while ( TheWorkQueue.Dispatch () );
+}
+
+// gives a running motor its three drips, the last turns it off and it ramps down
+void OilUntilStopped ( uint8_t uiMotorIndex )
+{
+	for ( uint8_t i = 0; i < 3; i++ )
+	{
+		TheWorkQueue.Post ( MotorWorkHandler, uiMotorIndex );
+	}
+	while ( TheWorkQueue.Dispatch () );
+	Check ( TheOiler.GetMotorState ( uiMotorIndex ) == MotorClass::RUNNING, "motor ramping down after its target" );
+	Check ( TheOiler.GetStatus () == OilerClass::OILING, "oiling while the motor ramps down" );
+
+	uint32_t ulTicks = 0;
+	while ( TheOiler.GetMotorState ( uiMotorIndex ) == MotorClass::RUNNING && ulTicks++ < MAX_STEP_TICKS )
+	{
+		StepTick ();
+	}
+	Check ( TheOiler.GetMotorState ( uiMotorIndex ) == MotorClass::STOPPED, "motor stopped at the bottom of its ramp" );
+}
+
+// both motors get up to speed, then stop one after the other
+void OilBoth ( uint8_t uiFirst, uint8_t uiLast )
+{
+	TheOiler.On ();
+	for ( uint16_t i = 0; i < 2000; i++ )
+	{
+		StepTick ();
+	}
+	OilUntilStopped ( uiFirst );
+	Check ( TheOiler.GetStatus () == OilerClass::OILING, "oiling while one motor runs" );
+	OilUntilStopped ( uiLast );
+}
+
+int main ( void )
+{
+	TheOiler.AddMotor ( 4, 5, 6, 7, 800, 17, 3, 2000, 64 );
+	TheOiler.AddMotor ( 8, 100, 64, 18, 3 );
+
+	// ON_TIME, the STEP / DIR motor stops last
+	TheOiler.SetStartMode ( OilerClass::ON_TIME, TIME_BETWEEN_OILING );
+	OilBoth ( 0, 1 );
+	Check ( TheOiler.GetStatus () == OilerClass::IDLE, "idle once the motors have stopped" );
+	Check ( TheOiler.GetTransitionCount ( OILER_OILING, OILER_MOTOR_STOPPED ) == 1, "motor stopped transition counted" );
+	TheOiler.Off ();
+
+	// machine work units, the four pin motor stops last
+	TheMachine.AddFeatures ( 12, 13, 2, 3 );
+	TheOiler.AddMachine ( &TheMachine );
+	TheOiler.SetStartMode ( OilerClass::ON_TARGET_ACTIVITY, 3 );
+	OilBoth ( 1, 0 );
+	Check ( TheOiler.GetStatus () == OilerClass::IDLE, "machine mode idle once the motors have stopped" );
+	for ( uint8_t i = 0; i < 3; i++ )
+	{
+		TheMachine.IncWorkUnit ( 1 );
+	}
+	while ( TheWorkQueue.Dispatch () );
+	Check ( TheOiler.GetStatus () == OilerClass::OILING, "oiling when the machine is ready" );
+	Check ( TheOiler.m_ulOilingFailed == 0, "not counted as a late oiling" );
+	TheOiler.Off ();
+
+	printf ( "RampedMotorTest: %u checks, %u failed\n", uiChecks, uiFailed );
+	return uiFailed == 0 ? 0 : 1;
+}
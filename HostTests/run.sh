@@ -0,0 +1,15 @@
+#!/bin/sh
+# 
+#  run.sh
+# 
+# (c) Mark Naylor June 2021
+#
+# Builds the oiler sources on a PC against the stand in Arduino core in Mock and runs each test, stops at the first that fails
+
+cd "$(dirname "$0")" || exit 1
+mkdir -p Build
+for Test in *Test.cpp
+do
+	g++ -std=gnu++11 -DARDUINO=108013 -IMock -I../OilerExample -o Build/"${Test%.cpp}" "$Test" Mock/Arduino.cpp ../OilerExample/*.cpp || exit 1
+	Build/"${Test%.cpp}" || exit 1
+done
@@ -16,10 +16,29 @@
 #define	MACHINE_ACTIVE_TIME_TARGET		30			// Number of seconds of active time after which target machine is ready to be oiled
 #define	MACHINE_WORK_PIN				13			// Pin on which pulse is sent when a unit of work by tarhet machine is completed, needs to be a pin that can be monitored by Pin Change Interrupts, set to NOT_A_PIN if not implemented
 #define	MACHINE_WORK_UNITS_TARGET		3			// Number of signals that indicates machine is ready (eg how many revolutions of spindle)
+#define EXPANDER_CHIPS					0			// Number of 74HC165 input expanders fitted, inputs are then given to sensors as EXPANDER_PIN ( chip, input ), see InputExpander.h
+#define EXPANDER_LOAD_PIN				10			// Pin wired to SH/LD of the 74HC165s, NB the expander also uses pins 12 & 13 so move the machine pins if fitted
+#define OUTPUT_EXPANDER_CHIPS			0			// Number of 74HC595 output expanders fitted, stepper pins can then be given as OUTPUT_PIN ( chip, output ), see OutputExpander.h
+#define OUTPUT_LATCH_PIN				9			// Pin wired to RCLK of the 74HC595s, NB the expander also uses pins 11 & 13 so move the machine work pin if fitted
 
 #define USING_STEPPER_MOTORS						// comment out if using relays
+//#define USING_STEPDIR_MOTOR						// uncomment if using a STEP / DIR driver instead, only one can be used, see StepDirMotor.h
+//#define USING_PWM_MOTORS							// uncomment, and comment out USING_STEPPER_MOTORS, if using DC motors with PWM speed control
 
-#ifdef USING_STEPPER_MOTORS
+#if defined USING_STEPDIR_MOTOR
+// Following is used to define a stepper motor on a STEP / DIR driver (A4988, DRV8825), STEP is always pin 10 so move EXPANDER_LOAD_PIN if fitted
+struct
+{
+	uint8_t		DirPin;
+	uint32_t	Speed;									// step interval in microseconds, with microstepping this can be short
+	uint16_t	RampSteps;								// steps taken to get up to Speed from STEPDIR_RAMP_START_SPEED, 0 for no ramp
+	uint8_t		MotorOutputPin;
+	uint8_t		Drips;
+} StepDirMotor [ 1 ] =
+{
+	{ 8, 100, 400, OILED_DEVICE_ACTIVE_PIN1, 3 }
+};
+#elif defined USING_STEPPER_MOTORS
 // Following is used to define a set of four pin relay stepper motors and and an associated sensor that signals when they have output ( e.g. drop of oil)
 struct
 {
@@ -30,17 +49,39 @@ struct
 	uint32_t	Speed;
 	uint8_t		MotorOutputPin;
 	uint8_t		Drips;
+	uint32_t	RampStartSpeed;							// step interval in microseconds the motor starts from and slows to before stopping
+	uint16_t	RampSteps;								// steps taken to get up to Speed, 0 for no ramp, with a ramp Speed can be a shorter interval
 } FourPinMotor [ NUM_MOTORS ] =
 // One motor config
 {
-	{ 4 ,5, 6, 7, 800, OILED_DEVICE_ACTIVE_PIN1, 3}
+	{ 4 ,5, 6, 7, 800, OILED_DEVICE_ACTIVE_PIN1, 3, 2000, 64 }
 };
+// Coil current policy for the steppers, below the speed their coils are only fully on around each step, see POWER_POLICY in Motor.h
+const POWER_POLICY StepperPower = { 4000, 2000, 500, 25 };		// slower than a step every 4ms, on for 2ms after and 0.5ms before a step, 25% between
 /* Two motor config example, NB change NUM_MOTORS above to 2									
 {
-	{ 4 ,5,  6,  7, 800, OILED_DEVICE_ACTIVE_PIN1, 3 }, 
-	{ 8, 9, 10, 11, 800, OILED_DEVICE_ACTIVE_PIN2, 4 }			// more oil drips on second motor for example
+	{ 4 ,5,  6,  7, 800, OILED_DEVICE_ACTIVE_PIN1, 3, 2000, 64 }, 
+	{ 8, 9, 10, 11, 800, OILED_DEVICE_ACTIVE_PIN2, 4, 2000, 64 }			// more oil drips on second motor for example
+};
+*/
+/* Two motors on one 74HC595 example, NB set OUTPUT_EXPANDER_CHIPS above to 1 and NUM_MOTORS to 2
+{
+	{ OUTPUT_PIN ( 0, 0 ), OUTPUT_PIN ( 0, 1 ), OUTPUT_PIN ( 0, 2 ), OUTPUT_PIN ( 0, 3 ), 800, OILED_DEVICE_ACTIVE_PIN1, 3, 2000, 64 },
+	{ OUTPUT_PIN ( 0, 4 ), OUTPUT_PIN ( 0, 5 ), OUTPUT_PIN ( 0, 6 ), OUTPUT_PIN ( 0, 7 ), 800, OILED_DEVICE_ACTIVE_PIN2, 4, 2000, 64 }
 };
 */
+#elif defined USING_PWM_MOTORS
+// Following is used to define a set of DC motors driven by PWM through a MOSFET or driver, on pins 5 and 6 only, see PWMMotor.h
+struct
+{
+	uint8_t		Pin1;
+	uint8_t		Speed;									// percent of full speed, can be changed while running with TheOiler.SetMotorSpeed
+	uint8_t		MotorOutputPin;
+	uint8_t		Drips;
+} PWMMotor [ NUM_MOTORS ] =
+{
+	{ 6, 60, OILED_DEVICE_ACTIVE_PIN1, 3 }
+};
 #else
 // Following is used to define a set of relays used to drive a dc motor and an associated sensor that signals when they have output ( e.g. drop of oil)
 struct
@@ -7,35 +7,38 @@
 //
 
 #include "FourPinStepperMotor.h"
-#include "Timer.h"
+#include "Profiler.h"
 
 
-uint8_t  PhaseSigs [ NUM_PHASES ][ NUM_PINS ] =
+// bit n set if pin n + 1 is HIGH in the phase, only read when a motor is constructed
+const uint8_t PhaseSigs [ NUM_PHASES ] PROGMEM =
 {
-      { HIGH,  LOW,  LOW,  LOW },   // 0
-      { HIGH, HIGH,  LOW,  LOW },   // 1
-      {  LOW, HIGH,  LOW,  LOW },   // 2
-      {  LOW, HIGH, HIGH,  LOW },   // 3
-      {  LOW,  LOW, HIGH,  LOW },   // 4
-      {  LOW,  LOW, HIGH, HIGH },   // 5
-      {  LOW,  LOW,  LOW, HIGH },   // 6
-      { HIGH,  LOW,  LOW, HIGH }    // 7
+      0b0001,                       // 0
+      0b0011,                       // 1
+      0b0010,                       // 2
+      0b0110,                       // 3
+      0b0100,                       // 4
+      0b1100,                       // 5
+      0b1000,                       // 6
+      0b1001                        // 7
 };
 
+FourPinStepperMotorClass::PENDING_WRITE FourPinStepperMotorClass::m_aPending [ MAX_PENDING_PORTS ];
+uint8_t FourPinStepperMotorClass::m_uiPending = 0;
 
-// List of 4 pin stepper motor instances used by timer callback interrupt routine
-MOTOR_INSTANCES MotorInstances = { 0, {0,0} };
+// Called by the step engine each time this motor's channel is due to step, the engine passes back the motor it belongs to
+void FourPinStepperMotorClass::StepCallback ( void* pContext )
+{
+    ( ( FourPinStepperMotorClass* ) pContext )->NextStep ();
+}
 
-// The following function is called by the timer and is used to check if any 4 pin stepper motors need signals output to move to the next step
-void MotorCallback ( void )
+// Called by the step engine every tick while this motor has a power policy
+void FourPinStepperMotorClass::PowerCallback ( void* pContext, uint16_t uiAccumulator, uint16_t uiIncrement )
 {
-    for ( uint8_t i = 0; i < MotorInstances.uiCount; i++ )
-    {
-        MotorInstances.pMotor [ i ]->NextStep ();
-    }
+    ( ( FourPinStepperMotorClass* ) pContext )->Power ( uiAccumulator, uiIncrement );
 }
 
-FourPinStepperMotorClass::FourPinStepperMotorClass ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint8_t uiPin4, uint32_t ulSpeed ) : MotorClass ( ulSpeed )
+FourPinStepperMotorClass::FourPinStepperMotorClass ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint8_t uiPin4, uint32_t ulSpeed, StepEngineClass* pStepEngine ) : MotorClass ( ulSpeed )
 {
     m_uiPins [ 0 ] = uiPin1;
     m_uiPins [ 1 ] = uiPin2;
@@ -43,14 +46,68 @@ FourPinStepperMotorClass::FourPinStepperMotorClass ( uint8_t uiPin1, uint8_t uiP
     m_uiPins [ 3 ] = uiPin4;
     m_ulStepInterval = ulSpeed;
     m_uiPhase = 0;
-    m_ulLastStepTime = 0;
+    m_pStepEngine = pStepEngine;
+    m_iStepChannel = INVALID_CHANNEL;
     m_eState = STOPPED;
-    MotorInstances.pMotor [ MotorInstances.uiCount++ ] = this;
-    // Set pins to output to driver
+    m_uiCruiseIncrement = StepEngineClass::IntervalToIncrement ( m_ulStepInterval );
+    m_uiRampEntries = 0;
+    m_uiRampIndex = 0;
+    m_uiStepsPerEntry = 0;
+    m_uiRampCount = 0;
+    m_uiSlowIncrement = 0;
+    m_uiSettleTicks = 1;
+    m_uiLeadTicks = 0;
+    m_uiHoldTicks = 0;
+    m_uiChop = 0;
+    m_bEnergised = false;
+    m_uiUnpoweredTicks = 0;
+    m_uiNumPorts = 0;
+    for ( uint8_t uiPhase = 0; uiPhase < NUM_PHASES; uiPhase++ )
+    {
+        for ( uint8_t uiPort = 0; uiPort < NUM_PINS; uiPort++ )
+        {
+            m_auiPhaseSet [ uiPhase ][ uiPort ] = 0;
+        }
+    }
+    // Set pins to output to driver, and group them by port
     for ( uint8_t uiPin = 0; uiPin < NUM_PINS; uiPin++ )
     {
-        pinMode ( m_uiPins [ uiPin ], OUTPUT );
+        volatile uint8_t*   puiPort;
+        uint8_t             uiBit;
+        uint8_t             uiPort  = 0;
+
+        if ( OutputExpanderClass::IsOutputPin ( m_uiPins [ uiPin ] ) )
+        {
+            // a 74HC595 output, its chip's frame byte is used as the port
+            puiPort = OutputExpanderClass::GetFrameByte ( m_uiPins [ uiPin ] );
+            uiBit   = 1 << ( ( m_uiPins [ uiPin ] - FIRST_OUTPUT_PIN ) & 7 );
+        }
+        else
+        {
+            puiPort = portOutputRegister ( digitalPinToPort ( m_uiPins [ uiPin ] ) );
+            uiBit   = digitalPinToBitMask ( m_uiPins [ uiPin ] );
+            pinMode ( m_uiPins [ uiPin ], OUTPUT );
+        }
+        while ( uiPort < m_uiNumPorts && m_aPorts [ uiPort ].puiPort != puiPort )
+        {
+            uiPort++;
+        }
+        if ( uiPort == m_uiNumPorts )
+        {
+            m_aPorts [ uiPort ].puiPort = puiPort;
+            m_aPorts [ uiPort ].uiMask  = 0;
+            m_uiNumPorts++;
+        }
+        m_aPorts [ uiPort ].uiMask |= uiBit;
+        for ( uint8_t uiPhase = 0; uiPhase < NUM_PHASES; uiPhase++ )
+        {
+            if ( pgm_read_byte ( &PhaseSigs [ uiPhase ] ) & ( 1 << uiPin ) )
+            {
+                m_auiPhaseSet [ uiPhase ][ uiPort ] |= uiBit;
+            }
+        }
     }
+    m_pStepEngine->GetTimer ()->SetServiceHook ( FlushPorts );
 }
 
 void FourPinStepperMotorClass::SetDirection ( eDirection Direction )
@@ -66,12 +123,48 @@ bool FourPinStepperMotorClass::On ( void )
     {
         bResult = true;
 
+        // don't let timer interrupt see motor half started
+        uint8_t uiSREG = SREG;
+        noInterrupts ();
+        PROFILE_CRITICAL_START ();
         PowerUp ();
 
         m_eState = MOVING;
+        m_uiRampIndex = 0;
+        m_uiRampCount = m_uiStepsPerEntry;
         MotorClass::On ();
+        PROFILE_CRITICAL_END ();
+        SREG = uiSREG;
+        PROFILE_CRITICAL_RECORD ( uiSREG );
 
-        bResult = TheTimer.AddCallBack ( MotorCallback, ( m_ulStepInterval / ( 1000000 / RESOLUTION ) + 1 ) );
+        m_iStepChannel = m_pStepEngine->AddChannel ( StepCallback, this, m_uiRampEntries > 0 ? m_auiRamp [ 0 ] : m_uiCruiseIncrement );
+        bResult = m_iStepChannel != INVALID_CHANNEL;
+        if ( bResult && m_uiSlowIncrement > 0 )
+        {
+            m_uiChop = 0;
+            m_pStepEngine->SetTickRoutine ( m_iStepChannel, PowerCallback );
+        }
+        if ( !bResult )
+        {
+            // no channel free, don't leave coils powered
+            uiSREG = SREG;
+            noInterrupts ();
+            Stop ();
+            SREG = uiSREG;
+        }
+    }
+    else if ( m_eState == STOPPING )
+    {
+        // still slowing down, speed up again from where it has got to
+        uint8_t uiSREG = SREG;
+        noInterrupts ();
+        PROFILE_CRITICAL_START ();
+        m_eState = MOVING;
+        m_uiRampCount = m_uiStepsPerEntry;
+        PROFILE_CRITICAL_END ();
+        SREG = uiSREG;
+        PROFILE_CRITICAL_RECORD ( uiSREG );
+        bResult = true;
     }
     return bResult;
 }
@@ -80,13 +173,95 @@ bool FourPinStepperMotorClass::Off ( void )
 {
     bool bResult = false;
 
-    for ( uint8_t uiPin = 0; uiPin < NUM_PINS; uiPin++ )
+    uint8_t uiSREG = SREG;
+    noInterrupts ();
+    PROFILE_CRITICAL_START ();
+    if ( m_eState == MOVING && m_uiRampEntries > 0 )
+    {
+        // slow down first, the timer interrupt stops the motor at the bottom of the ramp
+        m_eState = STOPPING;
+        m_uiRampCount = m_uiStepsPerEntry;
+        if ( m_uiRampIndex == m_uiRampEntries )
+        {
+            m_uiRampIndex--;
+            m_pStepEngine->SetIncrement ( m_iStepChannel, m_auiRamp [ m_uiRampIndex ] );
+        }
+    }
+    else if ( m_eState != STOPPING )
     {
-        digitalWrite ( m_uiPins [ uiPin ], LOW );
+        Stop ();
     }
-    m_ulLastStepTime = micros ();
+    PROFILE_CRITICAL_END ();
+    SREG = uiSREG;
+    PROFILE_CRITICAL_RECORD ( uiSREG );
+    return bResult;
+}
+
+// stop timer stepping motor again after pins are cleared, a motor that was ramping down has stopped after Off returned so says so
+void FourPinStepperMotorClass::Stop ( void )
+{
+    bool bRamped = m_eState == STOPPING;
+
+    m_pStepEngine->RemoveChannel ( m_iStepChannel );
+    m_iStepChannel = INVALID_CHANNEL;
+    Energise ( false );
+    FlushPorts ();
     m_eState = STOPPED;
     MotorClass::Off ();
+    if ( bRamped )
+    {
+        MotorClass::Stopped ();
+    }
+}
+
+// Times are rounded to engine ticks, at least the tick of the step itself is always fully on
+bool FourPinStepperMotorClass::SetPowerPolicy ( const POWER_POLICY& Policy )
+{
+    bool bResult = false;
+
+    if ( m_eState == STOPPED )
+    {
+        uint8_t uiPercent = Policy.uiHoldPercent < 100 ? Policy.uiHoldPercent : 100;
+
+        m_uiSlowIncrement = Policy.ulSlowus > 0 ? StepEngineClass::IntervalToIncrement ( Policy.ulSlowus ) : 0;
+        m_uiSettleTicks = ( Policy.uiSettleus + STEP_ENGINE_TICK_US / 2 ) / STEP_ENGINE_TICK_US;
+        if ( m_uiSettleTicks == 0 )
+        {
+            m_uiSettleTicks = 1;
+        }
+        m_uiLeadTicks = ( Policy.uiLeadus + STEP_ENGINE_TICK_US / 2 ) / STEP_ENGINE_TICK_US;
+        m_uiHoldTicks = ( uiPercent * POWER_CHOP_TICKS + 50 ) / 100;
+        bResult = true;
+    }
+    return bResult;
+}
+
+// Constant acceleration from the start speed means speed squared goes up evenly with each step. Engine increments are proportional to speed
+// so the increment at a fraction f of the way along the ramp is sqrt ( Start^2 + ( Cruise^2 - Start^2 ) * f )
+bool FourPinStepperMotorClass::SetRamp ( uint32_t ulStartSpeed, uint16_t uiRampSteps )
+{
+    bool bResult = false;
+
+    if ( m_eState == STOPPED )
+    {
+        uint32_t ulStart = StepEngineClass::IntervalToIncrement ( ulStartSpeed );
+
+        m_uiRampEntries = 0;
+        if ( uiRampSteps > 0 && ulStart < m_uiCruiseIncrement )
+        {
+            uint8_t     uiEntries   = uiRampSteps < RAMP_ENTRIES ? uiRampSteps : RAMP_ENTRIES;
+            uint32_t    ulStartSq   = ulStart * ulStart;
+            uint32_t    ulStep      = ( ( uint32_t )m_uiCruiseIncrement * m_uiCruiseIncrement - ulStartSq ) / uiEntries;
+
+            for ( uint8_t i = 0; i < uiEntries; i++ )
+            {
+                m_auiRamp [ i ] = SquareRoot ( ulStartSq + ulStep * i );
+            }
+            m_uiStepsPerEntry = ( uiRampSteps + uiEntries - 1 ) / uiEntries;
+            m_uiRampEntries = uiEntries;
+        }
+        bResult = true;
+    }
     return bResult;
 }
 
@@ -109,42 +284,159 @@ void FourPinStepperMotorClass::StepCCW ( void )
 
 void FourPinStepperMotorClass::MoveStepper ( uint8_t uiPhase )
 {
-    for ( uint8_t uiPin = 0; uiPin < NUM_PINS; uiPin++ )
+    for ( uint8_t uiPort = 0; uiPort < m_uiNumPorts; uiPort++ )
     {
-        digitalWrite ( m_uiPins [ uiPin ], PhaseSigs [ uiPhase ][ uiPin ] );
+        QueueWrite ( m_aPorts [ uiPort ].puiPort, m_aPorts [ uiPort ].uiMask, m_auiPhaseSet [ uiPhase ][ uiPort ] );
     }
     m_uiPhase = uiPhase;
-    m_ulLastStepTime = micros ();
-    m_ulNextStepTime = m_ulLastStepTime + m_ulStepInterval;
+    m_bEnergised = true;
 }
 
-// powers pins at current step pin config to get ready for move
-void FourPinStepperMotorClass::PowerUp ( void )
+// Called with interrupts off. A later write to the same port wins for the bits it clears
+void FourPinStepperMotorClass::QueueWrite ( volatile uint8_t* puiPort, uint8_t uiClear, uint8_t uiSet )
 {
-    MoveStepper ( m_uiPhase );
+    uint8_t uiEntry = 0;
+
+    while ( uiEntry < m_uiPending && m_aPending [ uiEntry ].puiPort != puiPort )
+    {
+        uiEntry++;
+    }
+    if ( uiEntry == m_uiPending )
+    {
+        if ( m_uiPending == MAX_PENDING_PORTS )
+        {
+            // can't happen with the Uno's 3 ports and the expander's frame bytes, but don't lose the step
+            FlushPorts ();
+            uiEntry = 0;
+        }
+        m_aPending [ uiEntry ].puiPort   = puiPort;
+        m_aPending [ uiEntry ].uiClear   = 0;
+        m_aPending [ uiEntry ].uiSet     = 0;
+        m_uiPending++;
+    }
+    m_aPending [ uiEntry ].uiClear |= uiClear;
+    m_aPending [ uiEntry ].uiSet    = ( m_aPending [ uiEntry ].uiSet & ~uiClear ) | uiSet;
+}
+
+// Called with interrupts off so nothing else can write the ports between the read and the write. If any write was to the output expander's
+// frame the whole frame is sent once, after all the motors' writes are merged into it
+void FourPinStepperMotorClass::FlushPorts ( void )
+{
+    bool bSendFrame = false;
+
+    for ( uint8_t uiEntry = 0; uiEntry < m_uiPending; uiEntry++ )
+    {
+        volatile uint8_t* puiPort = m_aPending [ uiEntry ].puiPort;
+        *puiPort = ( *puiPort & ~m_aPending [ uiEntry ].uiClear ) | m_aPending [ uiEntry ].uiSet;
+        if ( OutputExpanderClass::IsFrameByte ( puiPort ) )
+        {
+            bSendFrame = true;
+        }
+    }
+    m_uiPending = 0;
+    if ( bSendFrame )
+    {
+        OutputExpanderClass::Send ();
+    }
 }
 
-uint32_t FourPinStepperMotorClass::GetNextStepTime ( void )
+// powers pins at current step pin config to get ready for move, called with interrupts off
+void FourPinStepperMotorClass::PowerUp ( void )
 {
-    return m_ulNextStepTime;
+    MoveStepper ( m_uiPhase );
+    FlushPorts ();
 }
 
-// send signals for next step if time has elapsed
+// send signals for next step, timer only calls this when step is due
 void FourPinStepperMotorClass::NextStep ( void )
 {
     if ( m_eState != STOPPED )
     {
-        if ( micros () > GetNextStepTime () )
+        if ( m_eDir == FORWARD )
         {
-            if ( m_eDir == FORWARD )
-            {
-                StepCW ();
-            }
-            else
-            {
-                StepCCW ();
-            }
+            StepCW ();
+        }
+        else
+        {
+            StepCCW ();
+        }
+        if ( m_uiRampEntries > 0 )
+        {
+            Ramp ();
         }
     }
 }
 
+// Runs from the timer callback so a new interval applies to the next step
+void FourPinStepperMotorClass::Ramp ( void )
+{
+    if ( m_eState == MOVING )
+    {
+        if ( m_uiRampIndex < m_uiRampEntries && --m_uiRampCount == 0 )
+        {
+            m_uiRampIndex++;
+            m_uiRampCount = m_uiStepsPerEntry;
+            m_pStepEngine->SetIncrement ( m_iStepChannel, m_uiRampIndex < m_uiRampEntries ? m_auiRamp [ m_uiRampIndex ] : m_uiCruiseIncrement );
+        }
+    }
+    else if ( --m_uiRampCount == 0 )
+    {
+        if ( m_uiRampIndex == 0 )
+        {
+            Stop ();
+        }
+        else
+        {
+            m_uiRampIndex--;
+            m_uiRampCount = m_uiStepsPerEntry;
+            m_pStepEngine->SetIncrement ( m_iStepChannel, m_auiRamp [ m_uiRampIndex ] );
+        }
+    }
+}
+
+// Runs from the step engine tick after any step. The accumulator is how far through the interval the motor is, so the settle and lead times
+// are compared as ticks times the increment rather than dividing
+void FourPinStepperMotorClass::Power ( uint16_t uiAccumulator, uint16_t uiIncrement )
+{
+    bool bOn = true;
+
+    if ( m_eState != STOPPED && uiIncrement <= m_uiSlowIncrement )
+    {
+        uint32_t ulSettle = ( uint32_t ) m_uiSettleTicks * uiIncrement;
+        uint32_t ulLead   = ( uint32_t ) m_uiLeadTicks * uiIncrement;
+
+        if ( uiAccumulator >= ulSettle && uiAccumulator + ulLead < 65536UL )
+        {
+            bOn = m_uiChop < m_uiHoldTicks;
+        }
+        if ( ++m_uiChop == POWER_CHOP_TICKS )
+        {
+            m_uiChop = 0;
+        }
+    }
+    if ( bOn != m_bEnergised )
+    {
+        Energise ( bOn );
+    }
+    if ( !bOn && ++m_uiUnpoweredTicks == 1000000UL / STEP_ENGINE_TICK_US )
+    {
+        m_uiUnpoweredTicks = 0;
+        m_ulUnpoweredSecs++;
+    }
+}
+
+void FourPinStepperMotorClass::Energise ( bool bOn )
+{
+    if ( bOn )
+    {
+        MoveStepper ( m_uiPhase );
+    }
+    else
+    {
+        for ( uint8_t uiPort = 0; uiPort < m_uiNumPorts; uiPort++ )
+        {
+            QueueWrite ( m_aPorts [ uiPort ].puiPort, m_aPorts [ uiPort ].uiMask, 0 );
+        }
+        m_bEnergised = false;
+    }
+}
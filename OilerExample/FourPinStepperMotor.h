@@ -3,6 +3,22 @@
 //
 //	Defines 4 pin stepper motor as derivative of Motor
 //
+//	Steps are timed by TheStepEngine, a running motor is one of its channels. Steps are written straight to the port output registers. At
+//	construction the motor works out which ports its pins are on and, for each phase, which bits to set on each port, so a step is one
+//	read-modify-write per port. Steps made on an engine tick are saved up and written by the engine timer's service hook, so motors with pins
+//	on the same port that step together share a single write
+//
+//	Pins can also be outputs of a 74HC595 chain given as OUTPUT_PIN ( chip, output ), see OutputExpander.h. The chip's byte of the expander's
+//	frame is then treated as the motor's port and the frame is shifted out by the same service hook, once per tick for all motors on the chain
+//
+//	A motor can be given a ramp with SetRamp, it then starts at a slow step rate and speeds up to its set speed over a number of steps,
+//	and on Off slows down the same way before stopping. The ramp is for constant acceleration and is worked out as engine increments when
+//	it is set, RAMP_ENTRIES increments each used for an equal share of the steps, so the timer interrupt only looks up the next one
+//
+//	A motor given a POWER_POLICY with SetPowerPolicy watches its channel every engine tick while it steps slower than the policy's speed. Its
+//	coils are cut, or chopped on for part of each POWER_CHOP_TICKS ticks, once the settle time after a step has passed and put back on the
+//	lead time before the next step is due, so the phase is held firmly when it matters. The hold percentage is applied in quarters
+//
 // (c) Mark Naylor 2021
 //
 
@@ -15,49 +31,86 @@
 #include "WProgram.h"
 #endif
 #include "Motor.h"
+#include "StepEngine.h"
+#include "OutputExpander.h"
 
 #define NUM_PINS        4
 #define HALF_STEPS      2
 #define FULL_STEPS      1
 #define STEPPER_MODE    HALF_STEPS
 #define NUM_PHASES      ( NUM_PINS * STEPPER_MODE )
-#define MAX_MOTORS      2
+#define MAX_PENDING_PORTS   ( 3 + MAX_OUTPUT_CHIPS )        // different ports and frame bytes that can have a write saved up at once
+#define RAMP_ENTRIES        16                              // intervals in an acceleration ramp
+#define POWER_CHOP_TICKS    4                               // engine ticks in a chop cycle while holding, 400us
 
 
-class FourPinStepperMotorClass : MotorClass
+class FourPinStepperMotorClass final : public MotorClass
 {
 public:
 
-    enum            eStatus { MOVING, STATIONARY, STOPPED };
-    FourPinStepperMotorClass ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint8_t uiPin4, uint32_t ulSpeed );
+    enum            eStatus { MOVING, STATIONARY, STOPPED, STOPPING };
+    FourPinStepperMotorClass ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint8_t uiPin4, uint32_t ulSpeed, StepEngineClass* pStepEngine = &TheStepEngine );
     void            SetDirection ( eDirection Direction );
     void            NextStep ( void );
+    bool            SetRamp ( uint32_t ulStartSpeed, uint16_t uiRampSteps );     // start interval in us and steps taken to reach speed, 0 steps for no ramp, only while stopped
+    bool            SetPowerPolicy ( const POWER_POLICY& Policy );              // only while stopped
 
     bool            On ( void );
     bool            Off ( void );
     MotorClass::eState GetMotorState ( void );
+    static void     StepCallback ( void* pContext );        // called by timer each time this motor is due to step
+    static void     PowerCallback ( void* pContext, uint16_t uiAccumulator, uint16_t uiIncrement );    // called by step engine every tick when there is a power policy
 
 protected:
                     uint8_t         m_uiPins [ NUM_PINS ];  // Array of pins used to output signals to stepper driver
     volatile        uint8_t         m_uiPhase;              // The current phase of stepper (in half mode we have 8 phases numbered 0 - 7)
                     uint32_t        m_ulStepInterval;       // the delay time between micros
-                    uint32_t        m_ulLastStepTime;       // the last step time in micros
-                    uint32_t        m_ulNextStepTime;       // time next step due in micros
+                    StepEngineClass* m_pStepEngine;         // times the steps, normally TheStepEngine
+                    int8_t          m_iStepChannel;         // this motor's channel on m_pStepEngine while it is moving
                     eStatus         m_eState;               // keeps track of state of driver    
+                    uint16_t        m_auiRamp [ RAMP_ENTRIES ];     // step engine increments, slowest first
+                    uint16_t        m_uiCruiseIncrement;    // step engine increment once ramp is done
+                    uint8_t         m_uiRampEntries;        // entries of m_auiRamp in use, 0 if no ramp
+                    uint8_t         m_uiRampIndex;          // entry currently used, m_uiRampEntries when at speed
+                    uint16_t        m_uiStepsPerEntry;
+                    uint16_t        m_uiRampCount;          // steps left before moving to next entry
+                    uint16_t        m_uiSlowIncrement;      // power policy applies at this step engine increment and below, 0 for no policy
+                    uint16_t        m_uiSettleTicks;        // engine ticks coils stay on after a step, at least 1
+                    uint16_t        m_uiLeadTicks;          // engine ticks coils are on before a step
+                    uint8_t         m_uiHoldTicks;          // ticks of each chop cycle coils are on while holding
+                    uint8_t         m_uiChop;               // tick within chop cycle
+                    bool            m_bEnergised;           // coils are at m_uiPhase rather than off
+                    uint16_t        m_uiUnpoweredTicks;     // engine ticks with coils off, carried into m_ulUnpoweredSecs each second
+
+    typedef struct
+    {
+        volatile uint8_t*   puiPort;                        // output register
+        uint8_t             uiMask;                         // this motor's pins on the port, cleared before the phase's bits are set
+    } STEP_PORT;
+                    STEP_PORT       m_aPorts [ NUM_PINS ];  // ports the pins are on, usually all on one
+                    uint8_t         m_uiNumPorts;
+                    uint8_t         m_auiPhaseSet [ NUM_PHASES ][ NUM_PINS ];   // bits to set on each of m_aPorts for each phase
+
+    typedef struct
+    {
+        volatile uint8_t*   puiPort;
+        uint8_t             uiClear;
+        uint8_t             uiSet;
+    } PENDING_WRITE;
+    static          PENDING_WRITE   m_aPending [ MAX_PENDING_PORTS ];   // writes saved up during a timer pass, one per port
+    static          uint8_t         m_uiPending;
 
     void            StepCW ( void );                        // Move motor 1 step in clockwise direction
     void            StepCCW ( void );                       // Move motor 1 step in conunter clock wise direction
-    void            MoveStepper ( uint8_t uiPhase );        // Send stepper signals
+    void            MoveStepper ( uint8_t uiPhase );        // Queue stepper signals, written by FlushPorts
+    static void     QueueWrite ( volatile uint8_t* puiPort, uint8_t uiClear, uint8_t uiSet );     // merges with any write already queued for the port
+    static void     FlushPorts ( void );                    // writes queued signals, called with interrupts off, by the timer after each pass
     void            PowerUp ( void );                       // powers pins at current step pin config to get ready for move
-    uint32_t        GetNextStepTime ( void );
+    void            Ramp ( void );                          // after each step, moves along the ramp and sets the next interval
+    void            Stop ( void );                          // stops stepping and clears pins, called with interrupts off
+    void            Power ( uint16_t uiAccumulator, uint16_t uiIncrement );      // applies power policy for where the motor is between steps
+    void            Energise ( bool bOn );                  // queues current phase or clear pins, called with interrupts off
 
 };
 
-// used by interrupt routine to find all instances of motor
-typedef struct
-{
-    uint8_t                     uiCount;
-    FourPinStepperMotorClass*   pMotor [ MAX_MOTORS ];
-} MOTOR_INSTANCES;
-
 #endif
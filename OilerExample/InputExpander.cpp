@@ -0,0 +1,115 @@
+//
+//  InputExpander.cpp
+//
+// (c) Mark Naylor June 2021
+//
+//	Implements reading of 74HC165 shift registers over SPI, see InputExpander.h
+//
+
+#include "InputExpander.h"
+#include "Timer.h"
+#include "Profiler.h"
+
+volatile uint8_t*	InputExpanderClass::m_puiLoadPort = NULL;
+uint8_t				InputExpanderClass::m_uiLoadMask = 0;
+uint8_t				InputExpanderClass::m_uiChips = 0;
+volatile uint8_t	InputExpanderClass::m_auiInputs [ MAX_EXPANDER_PORTS ];
+volatile uint32_t	InputExpanderClass::m_ulScans = 0;
+
+InputExpanderClass::InputExpanderClass ( void )
+{
+	m_bScanning = false;
+}
+
+bool InputExpanderClass::Begin ( uint8_t uiLoadPin, uint8_t uiChips, uint32_t ulScanus )
+{
+	bool bResult = false;
+
+	if ( !m_bScanning && uiChips > 0 && uiChips <= MAX_EXPANDER_PORTS && digitalPinToPort ( uiLoadPin ) != NOT_A_PIN )
+	{
+		uint8_t auiInputs [ MAX_EXPANDER_PORTS ];
+
+		m_puiLoadPort	= portOutputRegister ( digitalPinToPort ( uiLoadPin ) );
+		m_uiLoadMask	= digitalPinToBitMask ( uiLoadPin );
+		m_uiChips		= uiChips;
+		digitalWrite ( uiLoadPin, HIGH );											// high to shift, pulsed low to load
+		pinMode ( uiLoadPin, OUTPUT );
+		pinMode ( SS, OUTPUT );
+		pinMode ( SCK, OUTPUT );
+		pinMode ( MISO, INPUT );
+
+		// master, clock idles high so each bit is read on the falling edge, half way between the rising edges that shift the chain, 4MHz
+		SPCR = ( 1 << SPE ) | ( 1 << MSTR ) | ( 1 << CPOL );
+		SPSR = 0;
+
+		// first scan only records the inputs so they aren't seen as changes
+		Read ( auiInputs );
+		for ( uint8_t i = 0; i < m_uiChips; i++ )
+		{
+			m_auiInputs [ i ] = auiInputs [ i ];
+			PCIHandlerClass::SeedPort ( NUM_PCI_PORTS + i, auiInputs [ i ] );
+		}
+		uint32_t ulTicks = TheTimer.MicrosToTicks ( ulScanus );
+		m_bScanning = TheTimer.AddCallBack ( Scan, ulTicks > 0 ? ulTicks : 1 );
+		bResult = m_bScanning;
+	}
+	return bResult;
+}
+
+void InputExpanderClass::End ( void )
+{
+	if ( m_bScanning )
+	{
+		TheTimer.RemoveCallBack ( Scan );
+		m_bScanning = false;
+	}
+}
+
+// Called from the timer interrupt. The load pin is written directly, its port can't be changed by an interrupt while this runs
+void InputExpanderClass::Scan ( void )
+{
+	PROFILE_ISR_START ();
+	uint8_t auiInputs [ MAX_EXPANDER_PORTS ];
+
+	Read ( auiInputs );
+	for ( uint8_t i = 0; i < m_uiChips; i++ )
+	{
+		m_auiInputs [ i ] = auiInputs [ i ];
+		PCIHandlerClass::CheckPortPins ( NUM_PCI_PORTS + i, auiInputs [ i ] );
+	}
+	m_ulScans++;
+	PROFILE_ISR_END ( PROFILE_EXPANDER );
+}
+
+void InputExpanderClass::Read ( uint8_t* puiInputs )
+{
+	// SH/LD low copies all the inputs into the registers at the same instant, one instruction is long enough
+	*m_puiLoadPort &= ~m_uiLoadMask;
+	*m_puiLoadPort |= m_uiLoadMask;
+	for ( uint8_t i = 0; i < m_uiChips; i++ )
+	{
+		SPDR = 0;
+		while ( !( SPSR & ( 1 << SPIF ) ) );
+		puiInputs [ i ] = SPDR;
+	}
+}
+
+uint8_t InputExpanderClass::GetInputs ( uint8_t uiChip )
+{
+	return uiChip < m_uiChips ? m_auiInputs [ uiChip ] : 0;
+}
+
+uint32_t InputExpanderClass::GetScans ( void )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	uint32_t ulResult = m_ulScans;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return ulResult;
+}
+
+InputExpanderClass TheInputExpander;
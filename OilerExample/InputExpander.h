@@ -0,0 +1,54 @@
+//
+//  InputExpander.h
+//
+// (c) Mark Naylor June 2021
+//
+//	This class reads a chain of 74HC165 parallel in, serial out shift registers to give 8 more inputs per chip from 3 pins, so many drip
+//	sensors can be used. The chips are read with the hardware SPI port: SCK (D13) to every chip's CLK, MISO (D12) to QH of the first chip
+//	in the chain with each chip's QH going to the SER of the one before it, and a load pin of your choice to every SH/LD. CLK INH is tied low.
+//
+//	The chain is scanned from a TheTimer callback. Each scan latches all the inputs at once and shifts in one byte per chip, each byte is then
+//	passed to PCIHandler as a virtual port which compares it with the last scan and runs the callbacks, filters and capture for the inputs
+//	that changed, just as a pin change interrupt does for a real port. Inputs are added with PCIHandler.AddPin using EXPANDER_PIN ( chip, input ).
+//	A scan takes a fixed time for the number of chips plus any callbacks, it is timed by TheProfiler as the "Expander" entry.
+//
+//	NB while in use D10 - D13 can't be used for anything else, D10 is SS and is made an output so the SPI port stays master. Edges shorter than the
+//	scan period may be missed and times are only as accurate as the scan period. The 74HC165 inputs have no pullups, fit resistors if needed.
+//
+#ifndef _INPUTEXPANDER_h
+#define _INPUTEXPANDER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include <Arduino.h>
+#else
+	#include "WProgram.h"
+#endif
+#include "PCIHandler.h"
+
+#define		EXPANDER_SCAN_US		1000UL									// default time between scans
+
+class InputExpanderClass
+{
+public:
+						InputExpanderClass ( void );
+	bool				Begin ( uint8_t uiLoadPin, uint8_t uiChips, uint32_t ulScanus = EXPANDER_SCAN_US );	// sets up SPI and starts scanning, up to MAX_EXPANDER_PORTS chips
+	void				End ( void );													// stops scanning, SPI is left on
+	uint8_t				GetInputs ( uint8_t uiChip );									// inputs A - H of chip as bits 0 - 7 at the last scan
+	uint32_t			GetScans ( void );
+	static void			Scan ( void );													// TheTimer callback, reads the chain and passes each chip's inputs to PCIHandler
+
+protected:
+	static void			Read ( uint8_t* puiInputs );									// latches inputs and shifts in one byte per chip
+
+	static volatile uint8_t*	m_puiLoadPort;											// output register and mask of the load pin, written directly as it is pulsed every scan
+	static uint8_t				m_uiLoadMask;
+	static uint8_t				m_uiChips;
+	static volatile uint8_t		m_auiInputs [ MAX_EXPANDER_PORTS ];
+	static volatile uint32_t	m_ulScans;
+	bool						m_bScanning;
+};
+
+extern InputExpanderClass TheInputExpander;
+
+#endif
+
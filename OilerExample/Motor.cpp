@@ -3,33 +3,42 @@
 // 
 
 #include "Motor.h"
+#include "Profiler.h"
+
+WorkHandler MotorClass::m_pStoppedHandler = NULL;
 
 MotorClass::MotorClass ( uint32_t ulSpeed )
 {
 	SetSpeed ( ulSpeed );
 	m_eState			= STOPPED;
-	m_ulTimeStartedms	= 0;
-	m_ulTimeStoppedms	= 0;
+	m_ullTimeStarted	= 0;
+	m_ullTimeStopped	= 0;
 	m_eDir				= FORWARD;
+	m_ullRunTicks		= 0;
+	m_ulUnpoweredSecs	= 0;
 }
 
 bool MotorClass::On ( void )
 {
-	m_ulTimeStartedms = millis ();
+	m_ullTimeStarted = TheTimer.GetTicks ();
 	m_eState = RUNNING;
 	return true;
 }
 
 bool MotorClass::Off ( void )
 {
-	m_ulTimeStoppedms = millis ();
+	m_ullTimeStopped = TheTimer.GetTicks ();
+	if ( m_eState == RUNNING )
+	{
+		m_ullRunTicks += m_ullTimeStopped - m_ullTimeStarted;
+	}
 	m_eState = STOPPED;
 	return true;
 }
 
-uint32_t MotorClass::GetTimeMotorStarted ( void )
+uint64_t MotorClass::GetTimeMotorStarted ( void )
 {
-	return 	m_ulTimeStartedms;
+	return 	m_ullTimeStarted;
 }
 
 uint32_t MotorClass::GetTimeMotorRunning ( void )
@@ -37,14 +46,14 @@ uint32_t MotorClass::GetTimeMotorRunning ( void )
 	uint32_t ulResult = 0UL;
 	if ( m_eState == RUNNING )
 	{
-		ulResult = ( millis () - m_ulTimeStartedms ) / 1000UL;
+		ulResult = TheTimer.ElapsedSecs ( m_ullTimeStarted );
 	}
 	return ulResult;
 }
 
-uint32_t MotorClass::GetTimeMotorStopped ( void )
+uint64_t MotorClass::GetTimeMotorStopped ( void )
 {
-	return m_ulTimeStoppedms;
+	return m_ullTimeStopped;
 }
 
 MotorClass::eState MotorClass::GetMotorState ( void )
@@ -69,5 +78,80 @@ void MotorClass::SetDirection ( eDirection eDir )
 	m_eDir = eDir;
 }
 
+bool MotorClass::SetPowerPolicy ( const POWER_POLICY& /* Policy */ )
+{
+	return false;
+}
+
+// A motor can be stopped from interrupt context, eg at the end of a ramp, so its run times are copied together with interrupts off, the
+// 64 bit total can't be read in one instruction
+uint32_t MotorClass::GetEnergisedSecs ( void )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	uint64_t	ullTicks	= m_ullRunTicks;
+	uint64_t	ullStarted	= m_ullTimeStarted;
+	bool		bRunning	= m_eState == RUNNING;
+	uint32_t	ulUnpowered	= m_ulUnpoweredSecs;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	if ( bRunning )
+	{
+		ullTicks += TheTimer.GetTicks () - ullStarted;
+	}
+	uint32_t ulSecs = TheTimer.TicksToSecs ( ullTicks );
+
+	return ulSecs > ulUnpowered ? ulSecs - ulUnpowered : 0;
+}
+
+void MotorClass::SetStoppedHandler ( WorkHandler pHandler )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	m_pStoppedHandler = pHandler;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+}
+
+// A motor still ramping down when it was turned off stops later in the step interrupt, anything waiting for it to stop would wait for
+// ever if the event were lost, so if the queue is full it is posted again shortly
+void MotorClass::Stopped ( void )
+{
+	if ( m_pStoppedHandler != NULL && !TheWorkQueue.Post ( m_pStoppedHandler ) )
+	{
+		TheTimer.AddTimer ( Stopped, MOTOR_STOPPED_RETRY_TICKS, TimerClass::ONE_SHOT );
+	}
+}
+
+// integer square root, used by motors to work out acceleration ramps when they are set
+uint32_t MotorClass::SquareRoot ( uint32_t ulValue )
+{
+	uint32_t ulResult = 0;
+	uint32_t ulBit = 1UL << 30;
+
+	while ( ulBit > ulValue )
+	{
+		ulBit >>= 2;
+	}
+	while ( ulBit != 0 )
+	{
+		if ( ulValue >= ulResult + ulBit )
+		{
+			ulValue -= ulResult + ulBit;
+			ulResult = ( ulResult >> 1 ) + ulBit;
+		}
+		else
+		{
+			ulResult >>= 1;
+		}
+		ulBit >>= 2;
+	}
+	return ulResult;
+}
 
 // MotorClass Motor;
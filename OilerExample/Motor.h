@@ -4,6 +4,13 @@
 //
 // defines base class for motors to drive oiler pump
 //
+// A stepper can be given a POWER_POLICY to save power and heat when it steps slowly. Below the policy's speed its coils are only fully on
+// for a settle time after each step and a lead time before the next, in between they are chopped on for a percentage of the time or turned
+// off. Every motor reports how long it has been energised, the time it has run less any time its coils were off.
+//
+// There are no virtual functions, a motor type hides the functions below it implements and TheMotors calls them by type, see MotorRegistry.h.
+// The base versions are what a type that doesn't implement one gets, and are called by the types that do to keep the times up to date
+//
 
 #ifndef _MOTOR_h
 #define _MOTOR_h
@@ -13,30 +20,53 @@
 #else
 #include "WProgram.h"
 #endif
+#include "Timer.h"
+#include "WorkQueue.h"
+
+#define		MAX_MOTORS			6							// most motors the oiler, registry and step engine allow, TheMotors keeps room for this many
+#define		MOTOR_STOPPED_RETRY_TICKS	( RESOLUTION / 10 )	// wait before posting the stopped handler again if the queue was full
+
+typedef struct POWER_POLICY
+{
+	uint32_t	ulSlowus;							// applies when the step interval is at least this long, 0 for coils always fully on
+	uint16_t	uiSettleus;							// coils fully on this long after each step
+	uint16_t	uiLeadus;							// and fully on again this long before the next
+	uint8_t		uiHoldPercent;						// time coils are on between, chopped, 0 for off
+} POWER_POLICY;
 
 class MotorClass
 {
 public:
 	enum			eDirection { FORWARD, BACKWARD };
 	enum			eState { STOPPED = 1, RUNNING };
-	virtual bool	On ( void );						// Needs to be overriden to implement details of how motor is enabled
-	virtual bool	Off ( void );
-	uint32_t		GetTimeMotorStarted ( void );		// returns millis that it started
+	bool			On ( void );						// Needs to be hidden by each type to implement details of how motor is enabled
+	bool			Off ( void );
+	uint64_t		GetTimeMotorStarted ( void );		// returns TheTimer ticks when it started
 	uint32_t		GetTimeMotorRunning ( void );		// returns seconds it has been running, 0 if stopped
-	uint32_t		GetTimeMotorStopped ( void );
+	uint64_t		GetTimeMotorStopped ( void );		// returns TheTimer ticks when it stopped
 	eState			GetMotorState ( void );
 	uint32_t		GetSpeed ( void );
-	bool			SetSpeed ( uint32_t ulSpeed );
-	void			SetDirection ( eDirection eDir );
+	bool			SetSpeed ( uint32_t ulSpeed );		// units are up to the motor, false if it can't change speed
+	void			SetDirection ( eDirection eDir );	// hidden by motors that have a direction signal
+	bool			SetPowerPolicy ( const POWER_POLICY& Policy );	// false if the motor has no coils to manage or is running
+	uint32_t		GetEnergisedSecs ( void );			// total seconds powered, over all runs
+	static void		SetStoppedHandler ( WorkHandler pHandler );	// posted when a motor that kept going after Off, eg to ramp down, stops, NULL for none
 
 					MotorClass ( uint32_t ulSpeed );
 
 protected:
+	static uint32_t	SquareRoot ( uint32_t ulValue );	// for working out ramps, not fast
+	static void		Stopped ( void );					// called in interrupt context by a motor that stopped after Off returned
+
+	static WorkHandler m_pStoppedHandler;
+
 	uint32_t	m_ulSpeed;
-	uint32_t	m_ulTimeStartedms;					// Time motor was last started in ms
-	uint32_t	m_ulTimeStoppedms;					// Time motor was last stopped in ms
+	uint64_t	m_ullTimeStarted;					// Time motor was last started in TheTimer ticks
+	uint64_t	m_ullTimeStopped;					// Time motor was last stopped in TheTimer ticks
 	eState		m_eState;
 	eDirection	m_eDir;
+	uint64_t	m_ullRunTicks;						// TheTimer ticks run before the current run
+	volatile uint32_t m_ulUnpoweredSecs;			// seconds with coils off while running, kept by the motor
 };
 
 //extern MotorClass Motor;
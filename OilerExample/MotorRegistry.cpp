@@ -0,0 +1,222 @@
+//
+//  MotorRegistry.cpp
+//
+// (c) Mark Naylor June 2021
+//
+//	Implements the arena and type dispatch for all motors, see MotorRegistry.h
+//
+
+#include "MotorRegistry.h"
+#include <new.h>
+
+MotorRegistryClass::MotorRegistryClass ( void )
+{
+	m_uiCount		= 0;
+	m_uiArenaUsed	= 0;
+}
+
+RelayMotorClass* MotorRegistryClass::AddRelayMotor ( uint8_t uiPin )
+{
+	RelayMotorClass* pResult = NULL;
+
+	if ( m_uiCount < MAX_MOTORS )
+	{
+		void* pSpace = Allocate ( sizeof ( RelayMotorClass ), alignof ( RelayMotorClass ) );
+		if ( pSpace != NULL )
+		{
+			pResult = new ( pSpace ) RelayMotorClass ( uiPin );
+			Register ( pResult, MOTOR_RELAY );
+		}
+	}
+	return pResult;
+}
+
+FourPinStepperMotorClass* MotorRegistryClass::AddFourPinMotor ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint8_t uiPin4, uint32_t ulSpeed )
+{
+	FourPinStepperMotorClass* pResult = NULL;
+
+	if ( m_uiCount < MAX_MOTORS )
+	{
+		void* pSpace = Allocate ( sizeof ( FourPinStepperMotorClass ), alignof ( FourPinStepperMotorClass ) );
+		if ( pSpace != NULL )
+		{
+			pResult = new ( pSpace ) FourPinStepperMotorClass ( uiPin1, uiPin2, uiPin3, uiPin4, ulSpeed );
+			Register ( pResult, MOTOR_FOUR_PIN );
+		}
+	}
+	return pResult;
+}
+
+StepDirMotorClass* MotorRegistryClass::AddStepDirMotor ( uint8_t uiDirPin, uint32_t ulSpeed )
+{
+	StepDirMotorClass* pResult = NULL;
+
+	if ( m_uiCount < MAX_MOTORS )
+	{
+		void* pSpace = Allocate ( sizeof ( StepDirMotorClass ), alignof ( StepDirMotorClass ) );
+		if ( pSpace != NULL )
+		{
+			pResult = new ( pSpace ) StepDirMotorClass ( uiDirPin, ulSpeed );
+			Register ( pResult, MOTOR_STEP_DIR );
+		}
+	}
+	return pResult;
+}
+
+PWMMotorClass* MotorRegistryClass::AddPWMMotor ( uint8_t uiPin, uint32_t ulSpeed )
+{
+	PWMMotorClass* pResult = NULL;
+
+	if ( m_uiCount < MAX_MOTORS )
+	{
+		void* pSpace = Allocate ( sizeof ( PWMMotorClass ), alignof ( PWMMotorClass ) );
+		if ( pSpace != NULL )
+		{
+			pResult = new ( pSpace ) PWMMotorClass ( uiPin, ulSpeed );
+			Register ( pResult, MOTOR_PWM );
+		}
+	}
+	return pResult;
+}
+
+uint8_t MotorRegistryClass::GetCount ( void )
+{
+	return m_uiCount;
+}
+
+int8_t MotorRegistryClass::GetLastAdded ( void )
+{
+	return ( int8_t ) m_uiCount - 1;
+}
+
+uint16_t MotorRegistryClass::GetArenaFree ( void )
+{
+	return MOTOR_ARENA_BYTES - m_uiArenaUsed;
+}
+
+eMotorType MotorRegistryClass::GetType ( uint8_t uiMotor )
+{
+	return uiMotor < m_uiCount ? ( eMotorType ) m_aMotors [ uiMotor ].uiType : MOTOR_NONE;
+}
+
+MotorClass* MotorRegistryClass::GetMotor ( uint8_t uiMotor )
+{
+	return uiMotor < m_uiCount ? m_aMotors [ uiMotor ].pMotor : NULL;
+}
+
+bool MotorRegistryClass::On ( uint8_t uiMotor )
+{
+	bool bResult = false;
+
+	switch ( GetType ( uiMotor ) )
+	{
+		case MOTOR_RELAY:		bResult = static_cast < RelayMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->On ();			break;
+		case MOTOR_FOUR_PIN:	bResult = static_cast < FourPinStepperMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->On ();	break;
+		case MOTOR_STEP_DIR:	bResult = static_cast < StepDirMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->On ();			break;
+		case MOTOR_PWM:			bResult = static_cast < PWMMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->On ();				break;
+		default:																												break;
+	}
+	return bResult;
+}
+
+bool MotorRegistryClass::Off ( uint8_t uiMotor )
+{
+	bool bResult = false;
+
+	switch ( GetType ( uiMotor ) )
+	{
+		case MOTOR_RELAY:		bResult = static_cast < RelayMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->Off ();			break;
+		case MOTOR_FOUR_PIN:	bResult = static_cast < FourPinStepperMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->Off ();	break;
+		case MOTOR_STEP_DIR:	bResult = static_cast < StepDirMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->Off ();			break;
+		case MOTOR_PWM:			bResult = static_cast < PWMMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->Off ();			break;
+		default:																												break;
+	}
+	return bResult;
+}
+
+MotorClass::eState MotorRegistryClass::GetMotorState ( uint8_t uiMotor )
+{
+	MotorClass::eState eResult = MotorClass::STOPPED;
+
+	switch ( GetType ( uiMotor ) )
+	{
+		case MOTOR_RELAY:		eResult = static_cast < RelayMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->GetMotorState ();			break;
+		case MOTOR_FOUR_PIN:	eResult = static_cast < FourPinStepperMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->GetMotorState ();	break;
+		case MOTOR_STEP_DIR:	eResult = static_cast < StepDirMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->GetMotorState ();		break;
+		case MOTOR_PWM:			eResult = static_cast < PWMMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->GetMotorState ();			break;
+		default:																															break;
+	}
+	return eResult;
+}
+
+void MotorRegistryClass::SetDirection ( uint8_t uiMotor, MotorClass::eDirection eDir )
+{
+	switch ( GetType ( uiMotor ) )
+	{
+		case MOTOR_RELAY:		static_cast < RelayMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetDirection ( eDir );			break;
+		case MOTOR_FOUR_PIN:	static_cast < FourPinStepperMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetDirection ( eDir );	break;
+		case MOTOR_STEP_DIR:	static_cast < StepDirMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetDirection ( eDir );		break;
+		case MOTOR_PWM:			static_cast < PWMMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetDirection ( eDir );			break;
+		default:																												break;
+	}
+}
+
+bool MotorRegistryClass::SetSpeed ( uint8_t uiMotor, uint32_t ulSpeed )
+{
+	bool bResult = false;
+
+	switch ( GetType ( uiMotor ) )
+	{
+		case MOTOR_RELAY:		bResult = static_cast < RelayMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetSpeed ( ulSpeed );			break;
+		case MOTOR_FOUR_PIN:	bResult = static_cast < FourPinStepperMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetSpeed ( ulSpeed );	break;
+		case MOTOR_STEP_DIR:	bResult = static_cast < StepDirMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetSpeed ( ulSpeed );		break;
+		case MOTOR_PWM:			bResult = static_cast < PWMMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetSpeed ( ulSpeed );			break;
+		default:																															break;
+	}
+	return bResult;
+}
+
+bool MotorRegistryClass::SetPowerPolicy ( uint8_t uiMotor, const POWER_POLICY& Policy )
+{
+	bool bResult = false;
+
+	switch ( GetType ( uiMotor ) )
+	{
+		case MOTOR_RELAY:		bResult = static_cast < RelayMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetPowerPolicy ( Policy );			break;
+		case MOTOR_FOUR_PIN:	bResult = static_cast < FourPinStepperMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetPowerPolicy ( Policy );	break;
+		case MOTOR_STEP_DIR:	bResult = static_cast < StepDirMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetPowerPolicy ( Policy );			break;
+		case MOTOR_PWM:			bResult = static_cast < PWMMotorClass* > ( m_aMotors [ uiMotor ].pMotor )->SetPowerPolicy ( Policy );			break;
+		default:																																break;
+	}
+	return bResult;
+}
+
+// Motors are never removed so the arena only grows, there is nothing to fragment
+void* MotorRegistryClass::Allocate ( size_t uiSize, size_t uiAlign )
+{
+	void*		pResult	= NULL;
+	uint16_t	uiStart	= ( m_uiArenaUsed + uiAlign - 1 ) & ~( uiAlign - 1 );
+
+	if ( uiStart + uiSize <= MOTOR_ARENA_BYTES )
+	{
+		pResult = &m_auiArena [ uiStart ];
+		m_uiArenaUsed = uiStart + uiSize;
+	}
+	return pResult;
+}
+
+bool MotorRegistryClass::Register ( MotorClass* pMotor, eMotorType eType )
+{
+	bool bResult = false;
+
+	if ( m_uiCount < MAX_MOTORS )
+	{
+		m_aMotors [ m_uiCount ].pMotor	= pMotor;
+		m_aMotors [ m_uiCount ].uiType	= eType;
+		m_uiCount++;
+		bResult = true;
+	}
+	return bResult;
+}
+
+MotorRegistryClass TheMotors;
@@ -0,0 +1,82 @@
+//
+//  MotorRegistry.h
+//
+// (c) Mark Naylor June 2021
+//
+//	This class holds every motor in the sketch. Motors are built in place in a fixed size arena rather than on the heap, so a 2K Uno can't
+//	run out of memory or fragment it after setup, and the arena's size is known when the sketch is compiled. Each motor is registered with
+//	its type and is from then on known by its index, 0 for the first added.
+//
+//	The arena is sized for MAX_MOTORS of the largest motor type, lower MAX_MOTORS in Motor.h to save RAM if fewer motors are used.
+//
+//	Calls on a motor by index are dispatched by a switch on its type to the motor class's own function. Motor classes have no virtual
+//	functions and are final, so each call is a direct one the compiler can inline and there are no vtables taking RAM. Functions every
+//	motor shares, such as running times, are reached through GetMotor.
+//
+//	To add a motor type give it an eMotorType, an Add function and a case in each dispatch function.
+//
+#ifndef _MOTORREGISTRY_h
+#define _MOTORREGISTRY_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include <Arduino.h>
+#else
+	#include "WProgram.h"
+#endif
+#include "RelayMotor.h"
+#include "FourPinStepperMotor.h"
+#include "StepDirMotor.h"
+#include "PWMMotor.h"
+
+// The arena has a slot of the largest motor type for each of MAX_MOTORS, so any mix of motors the oiler allows fits. Each slot is rounded up
+// to the arena's alignment so padding between motors of different types can't push the last one out, on AVR it is 1 and nothing is added
+#define		MOTOR_SIZE_MAX( a, b )	( ( a ) > ( b ) ? ( a ) : ( b ) )
+#define		MOTOR_LARGEST_BYTES		MOTOR_SIZE_MAX ( MOTOR_SIZE_MAX ( sizeof ( RelayMotorClass ), sizeof ( FourPinStepperMotorClass ) ), MOTOR_SIZE_MAX ( sizeof ( StepDirMotorClass ), sizeof ( PWMMotorClass ) ) )
+#define		MOTOR_SLOT_BYTES		( ( MOTOR_LARGEST_BYTES + __BIGGEST_ALIGNMENT__ - 1 ) & ~( __BIGGEST_ALIGNMENT__ - 1 ) )
+#define		MOTOR_ARENA_BYTES		( MAX_MOTORS * MOTOR_SLOT_BYTES )
+#define		INVALID_MOTOR			-1
+
+enum eMotorType { MOTOR_NONE, MOTOR_RELAY, MOTOR_FOUR_PIN, MOTOR_STEP_DIR, MOTOR_PWM };
+
+class MotorRegistryClass
+{
+public:
+								MotorRegistryClass ( void );
+	RelayMotorClass*			AddRelayMotor ( uint8_t uiPin );						// each Add returns NULL if there is no room left in the arena or registry
+	FourPinStepperMotorClass*	AddFourPinMotor ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint8_t uiPin4, uint32_t ulSpeed );
+	StepDirMotorClass*			AddStepDirMotor ( uint8_t uiDirPin, uint32_t ulSpeed );
+	PWMMotorClass*				AddPWMMotor ( uint8_t uiPin, uint32_t ulSpeed );
+	uint8_t						GetCount ( void );
+	int8_t						GetLastAdded ( void );									// index of the last motor added, INVALID_MOTOR if none
+	uint16_t					GetArenaFree ( void );									// bytes left for more motors
+	eMotorType					GetType ( uint8_t uiMotor );
+	MotorClass*					GetMotor ( uint8_t uiMotor );							// for the functions all motors share, NULL if no such motor
+
+	// dispatched to the motor's own class, each does nothing and returns false / STOPPED for a bad index
+	bool						On ( uint8_t uiMotor );
+	bool						Off ( uint8_t uiMotor );
+	MotorClass::eState			GetMotorState ( uint8_t uiMotor );
+	void						SetDirection ( uint8_t uiMotor, MotorClass::eDirection eDir );
+	bool						SetSpeed ( uint8_t uiMotor, uint32_t ulSpeed );
+	bool						SetPowerPolicy ( uint8_t uiMotor, const POWER_POLICY& Policy );
+
+protected:
+	void*						Allocate ( size_t uiSize, size_t uiAlign );				// next free space in the arena, NULL if not enough
+	bool						Register ( MotorClass* pMotor, eMotorType eType );
+
+	typedef struct
+	{
+		MotorClass*				pMotor;												// in m_auiArena
+		uint8_t					uiType;												// eMotorType
+	} MOTOR_ENTRY;
+
+	MOTOR_ENTRY					m_aMotors [ MAX_MOTORS ];
+	uint8_t						m_uiCount;
+	uint16_t					m_uiArenaUsed;
+	uint8_t						m_auiArena [ MOTOR_ARENA_BYTES ] __attribute__ ( ( aligned ) );
+};
+
+extern MotorRegistryClass TheMotors;
+
+#endif
+
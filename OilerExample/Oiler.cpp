@@ -6,61 +6,59 @@
 #include "Oiler.h"
 #include "Timer.h"
 #include "PCIHandler.h"
+#include "WorkQueue.h"
 
-void Motor1WorkSignal ( void )
+// Deferred work, run from loop by TheWorkQueue.Dispatch rather than in interrupt context. Each hands its event to the oiler's state machine,
+// interrupts reach it only through the queue so events are handled one at a time from loop
+void MotorWorkHandler ( uint8_t uiMotorIndex )
 {
-	static uint32_t ulLastSignal = 0;
-	uint32_t tNow = millis ();
+	TheOiler.HandleEvent ( OILER_MOTOR_WORK, uiMotorIndex );
+}
 
-	if ( ( tNow - ulLastSignal ) > DEBOUNCE_THRESHOLD )
-	{
-		ulLastSignal = tNow;
-		TheOiler.MotorWork ( 0 );
-	}
+void OilerDeadlineHandler ( uint8_t /* uiParam */ )
+{
+	TheOiler.HandleEvent ( OILER_DEADLINE, 0 );
 }
 
-void Motor2WorkSignal ( void )
+void MachineReadyHandler ( uint8_t uiReason )
 {
-	static uint32_t ulLastSignal = 0;
-	uint32_t tNow = millis ();
+	TheOiler.HandleEvent ( OILER_MACHINE_READY, uiReason );
+}
 
-	if ( ( tNow - ulLastSignal ) > DEBOUNCE_THRESHOLD )
-	{
-		ulLastSignal = tNow;
-		TheOiler.MotorWork ( 1 );
-	}
+void MotorStoppedHandler ( uint8_t /* uiParam */ )
+{
+	TheOiler.HandleEvent ( OILER_MOTOR_STOPPED, 0 );
 }
 
-// list of ISRs for each possible motor
-typedef void ( *Callback )( void );
-struct
+// Interrupt routine, this only queues the work. The drip sensor pins are debounced by PCIHandler before it is called. PCIHandler callbacks
+// have no context so one is made for each motor index by the template
+template < uint8_t uiMotorIndex > void MotorWorkSignal ( void )
 {
-	Callback MotorWorkCallback [ MAX_MOTORS ];
-} MotorISRs =
+	TheWorkQueue.Post ( MotorWorkHandler, uiMotorIndex );
+}
+
+const PIN_FILTER DripFilter = { DRIP_MIN_PULSE, DEBOUNCE_THRESHOLD * 1000UL, false };
+
+// list of ISRs for each possible motor, MotorWorkSignal < 0 > to MotorWorkSignal < MAX_MOTORS - 1 >, built when compiled so it always
+// matches MAX_MOTORS
+template < uint8_t... uiIndex > struct MotorISRList
 {
-	Motor1WorkSignal,
-	Motor2WorkSignal
+	static const InterruptCallback MotorWorkCallback [ sizeof... ( uiIndex ) ];
 };
+template < uint8_t... uiIndex > const InterruptCallback MotorISRList < uiIndex... >::MotorWorkCallback [ sizeof... ( uiIndex ) ] = { MotorWorkSignal < uiIndex >... };
 
-void OilerTmerCallback ( void )
-{
-	if ( TheOiler.GetStatus () != OilerClass::OFF )
-	{
-		// Invoked once per second to check if oiler needs starting
-		switch ( TheOiler.GetStartMode () )
-		{
-			case OilerClass::ON_TIME:
-				TheOiler.CheckElapsedTime ();
-				break;
+template < uint8_t uiCount, uint8_t... uiIndex > struct MakeMotorISRList : MakeMotorISRList < uiCount - 1, uiCount - 1, uiIndex... > {};
+template < uint8_t... uiIndex > struct MakeMotorISRList < 0, uiIndex... > : MotorISRList < uiIndex... > {};
 
-			case OilerClass::ON_POWERED_TIME:
-			case OilerClass::ON_TARGET_ACTIVITY:
-				TheOiler.CheckTargetReady ();
-				break;
+typedef MakeMotorISRList < MAX_MOTORS > MotorISRs;
 
-			default:
-				break;
-		}
+// Called by timer when the earliest motor deadline is reached. A lost deadline would leave ON_TIME motors waiting for ever, so if the queue
+// is full it is tried again shortly, a retry that finds nothing due just sets the deadline again
+void OilerDeadlineCallback ( void )
+{
+	if ( !TheWorkQueue.Post ( OilerDeadlineHandler ) )
+	{
+		TheTimer.AddTimer ( OilerDeadlineCallback, DEADLINE_RETRY_TICKS, TimerClass::ONE_SHOT );
 	}
 }
 
@@ -73,58 +71,245 @@ OilerClass::OilerClass ( TargetMachineClass* pMachine )
 	m_Motors.uiNumMotors	= 0;
 	m_uiAlertPin			= NOT_A_PIN;
 	m_ulAlertMultiple		= 0UL;
+	m_hDeadline				= INVALID_TIMER;
+	m_ulOilingFailed		= 0;
+	m_uiRefused				= 0;
+	m_uiFollowUp			= NUM_OILER_EVENTS;
+	for ( uint8_t i = 0; i < NUM_OILER_STATES; i++ )
+	{
+		for ( uint8_t j = 0; j < NUM_OILER_EVENTS; j++ )
+		{
+			m_auiTransitions [ i ][ j ] = 0;
+		}
+	}
+	// a motor ramping down when it reaches its target is still running after Off, it raises OILER_MOTOR_STOPPED when it stops
+	MotorClass::SetStoppedHandler ( MotorStoppedHandler );
 }
 
+// Starting and stopping are events like any other. They are called from loop, as is everything else that runs the state machine, so they
+// are handled straight away rather than queued where they could be lost
 bool OilerClass::On ()
 {
 	// can only start if > 0 motors!
 	bool bResult = false;
 	if ( m_Motors.uiNumMotors > 0 )
 	{
-		for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
+		HandleEvent ( OILER_START, 0 );
+		bResult = true;
+	}
+	return bResult;
+}
+
+void OilerClass::Off ()
+{
+	HandleEvent ( OILER_STOP, 0 );
+}
+
+// The only place the oiler's state is changed. It is only called from loop, directly or by TheWorkQueue.Dispatch, so never interrupts
+// itself. An event an action raises, see FollowUp, is handled here once the state has moved on from the one that raised it
+void OilerClass::HandleEvent ( uint8_t uiEvent, uint8_t uiParam )
+{
+	do
+	{
+		OILER_TRANSITION Transition;
+
+		m_uiFollowUp = NUM_OILER_EVENTS;
+		if ( GetOilerTransition ( m_OilerStatus, uiEvent, &Transition ) )
 		{
-			m_Motors.MotorInfo [ i ].Motor->On ();
-			m_Motors.MotorInfo [ i ].uiWorkCount = 0;
+			if ( RunAction ( Transition.uiAction, uiParam ) )
+			{
+				if ( m_auiTransitions [ m_OilerStatus ][ uiEvent ] != 0xFFFF )
+				{
+					m_auiTransitions [ m_OilerStatus ][ uiEvent ]++;
+				}
+				m_OilerStatus = ( eStatus ) Transition.uiNextState;
+			}
+			else if ( m_uiRefused != 0xFFFF )
+			{
+				m_uiRefused++;
+			}
 		}
-		// if we have a machine, start monitoring
-		if ( m_OilerMode != ON_TIME && m_pMachine != NULL )
+		uiEvent = m_uiFollowUp;
+		uiParam = 0;
+	} while ( uiEvent != NUM_OILER_EVENTS );
+}
+
+// Called by an action for an event that follows from it, an action raises at most one
+void OilerClass::FollowUp ( uint8_t uiEvent )
+{
+	m_uiFollowUp = uiEvent;
+}
+
+// Returns false if the action refuses the event, the state is then left as it is
+bool OilerClass::RunAction ( uint8_t uiAction, uint8_t uiParam )
+{
+	bool bResult = true;
+
+	switch ( uiAction )
+	{
+		case OILER_START_MOTORS:
+			StartMotors ();
+			break;
+
+		case OILER_STOP_MOTORS:
+			StopMotors ();
+			break;
+
+		case OILER_COUNT_WORK:
+			CountWork ( uiParam );
+			break;
+
+		case OILER_REST:
+			bResult = Rest ();
+			break;
+
+		case OILER_SERVE_DEADLINES:
+			ServeDeadlines ();
+			break;
+
+		case OILER_OIL_LATE:
+			bResult = IsStartTarget ( uiParam );
+			if ( bResult )
+			{
+				// Still Oiling and machine is ready for more oil - one or more motors isn't outputting in time
+				m_ulOilingFailed++;
+				CheckError ( m_ulOilingFailed, 1 );
+				StartMotors ();
+			}
+			break;
+
+		case OILER_OIL_MACHINE:
+			bResult = IsStartTarget ( uiParam );
+			if ( bResult )
+			{
+				m_ulOilingFailed = 0;
+				StartMotors ();
+			}
+			break;
+
+		default:
+			break;
+	}
+	return bResult;
+}
+
+void OilerClass::StartMotors ( void )
+{
+	for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
+	{
+		StartMotor ( i );
+	}
+	ArmDeadline ();
+	// if we have a machine, start monitoring, it tells us when it is ready for oil
+	if ( m_OilerMode != ON_TIME && m_pMachine != NULL )
+	{
+		m_pMachine->SetReadyHandler ( MachineReadyHandler );
+		m_pMachine->RestartMonitoring ();
+	}
+}
+
+void OilerClass::StopMotors ( void )
+{
+	for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
+	{
+		TheMotors.Off ( m_Motors.MotorInfo [ i ].uiMotor );
+		m_Motors.MotorInfo [ i ].ullDue = 0;
+	}
+	ArmDeadline ();
+	m_timeOilerStopped = TheTimer.GetTicks ();
+}
+
+// One of Oiler motors has completed work, when it reaches its target it is stopped and if that leaves none running OILER_MOTORS_DONE follows
+void OilerClass::CountWork ( uint8_t uiMotorIndex )
+{
+	if ( uiMotorIndex < m_Motors.uiNumMotors )
+	{
+		m_Motors.MotorInfo [ uiMotorIndex ].uiWorkCount++;
+		// check if it has hit target
+		if ( m_Motors.MotorInfo [ uiMotorIndex ].uiWorkCount >= m_Motors.MotorInfo [ uiMotorIndex ].uiWorkTarget &&
+			 TheMotors.GetMotorState ( m_Motors.MotorInfo [ uiMotorIndex ].uiMotor ) == MotorClass::RUNNING )
 		{
-			m_pMachine->RestartMonitoring ();
+			// hit target, stop motor, in ON_TIME mode it is next due after the oiling interval
+			if ( m_OilerMode == ON_TIME && m_OilerStatus != OFF )
+			{
+				m_Motors.MotorInfo [ uiMotorIndex ].ullDue = TheTimer.GetTicks () + TheTimer.SecsToTicks ( m_ulOilTime );
+				ArmDeadline ();
+			}
+			TheMotors.Off ( m_Motors.MotorInfo [ uiMotorIndex ].uiMotor );
+			if ( AllMotorsStopped () )
+			{
+				FollowUp ( OILER_MOTORS_DONE );
+			}
 		}
+	}
+}
+
+// A motor may have been restarted by its deadline since OILER_MOTORS_DONE was raised
+bool OilerClass::Rest ( void )
+{
+	bool bResult = false;
 
-		TheTimer.AddCallBack ( OilerTmerCallback, RESOLUTION );		// callback once per sec
-		m_OilerStatus = OILING;
+	if ( AllMotorsStopped () )
+	{
+		ClearError ();
+		// restart monitoring, if we have a machine
+		if ( m_pMachine != NULL && m_OilerMode != ON_TIME )
+		{
+			m_pMachine->RestartMonitoring ();
+		}
+		// reset start time count
+		m_timeOilerStopped = TheTimer.GetTicks ();
 		bResult = true;
 	}
 	return bResult;
 }
 
-void OilerClass::Off ()
+// Only the machine target for the current mode starts the oiler
+bool OilerClass::IsStartTarget ( uint8_t uiReason )
 {
-	for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
+	return m_pMachine != NULL &&
+		   ( ( m_OilerMode == ON_TARGET_ACTIVITY && uiReason == TargetMachineClass::WORK_UNITS_DONE ) ||
+			 ( m_OilerMode == ON_POWERED_TIME && uiReason == TargetMachineClass::ACTIVE_TIME_DONE ) );
+}
+
+uint16_t OilerClass::GetTransitionCount ( uint8_t uiState, uint8_t uiEvent )
+{
+	return uiState < NUM_OILER_STATES && uiEvent < NUM_OILER_EVENTS ? m_auiTransitions [ uiState ][ uiEvent ] : 0;
+}
+
+uint16_t OilerClass::GetRefusedCount ( void )
+{
+	return m_uiRefused;
+}
+
+void OilerClass::Dump ( void )
+{
+	Serial.print ( F ( "\nOiler transitions, state: count for each event" ) );
+	for ( uint8_t i = 0; i < NUM_OILER_STATES; i++ )
 	{
-		m_Motors.MotorInfo [ i ].Motor->Off ();
+		Serial.print ( F ( "\n" ) ); Serial.print ( i ); Serial.print ( F ( ":" ) );
+		for ( uint8_t j = 0; j < NUM_OILER_EVENTS; j++ )
+		{
+			Serial.print ( F ( " " ) ); Serial.print ( m_auiTransitions [ i ][ j ] );
+		}
 	}
-	m_OilerStatus = OFF;
-	m_timeOilerStopped = millis ();
+	Serial.print ( F ( "\nRefused: " ) ); Serial.print ( m_uiRefused );
+	Serial.print ( F ( "\nLost from queue: " ) ); Serial.print ( TheWorkQueue.GetOverflows () );
+	Serial.println ();
 }
 
-bool OilerClass::AddMotor ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint8_t uiPin4, uint32_t ulSpeed, uint8_t uiWorkPin, uint8_t uiWorkTarget )
+bool OilerClass::AddMotor ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint8_t uiPin4, uint32_t ulSpeed, uint8_t uiWorkPin, uint8_t uiWorkTarget, uint32_t ulRampStartSpeed, uint16_t uiRampSteps )
 {
 	bool bResult = false;
-	if ( m_Motors.uiNumMotors < MAX_MOTORS /* && digitalPinToInterrupt (uiWorkPin) != NOT_AN_INTERRUPT */ )
+	if ( m_Motors.uiNumMotors < MAX_MOTORS && ClaimWorkPin ( uiWorkPin ) )
 	{
-		// space to add another motor
-		m_Motors.MotorInfo [ m_Motors.uiNumMotors ].Motor = (MotorClass*)new FourPinStepperMotorClass ( uiPin1, uiPin2, uiPin3, uiPin4, ulSpeed );
-		SetupMotorPins ( uiWorkPin, uiWorkTarget );
-/*
-		m_Motors.MotorInfo [ m_Motors.uiNumMotors ].uiWorkPin = uiWorkPin;
-		m_Motors.MotorInfo [ m_Motors.uiNumMotors ].uiWorkTarget = uiWorkTarget;
-		pinMode ( uiWorkPin, MOTOR_WORK_SIGNAL_PINMODE );
-		attachInterrupt ( digitalPinToInterrupt ( uiWorkPin ), MotorISRs.MotorWorkCallback [ m_Motors.uiNumMotors ], MOTOR_WORK_SIGNAL_MODE );
-		m_Motors.uiNumMotors++;
-*/
-		bResult = true;
+		// space to add another motor and its sensor is monitored
+		FourPinStepperMotorClass* pMotor = TheMotors.AddFourPinMotor ( uiPin1, uiPin2, uiPin3, uiPin4, ulSpeed );
+		if ( pMotor != NULL )
+		{
+			pMotor->SetRamp ( ulRampStartSpeed, uiRampSteps );
+		}
+		bResult = SetupMotor ( pMotor != NULL, uiWorkPin, uiWorkTarget );
 	}
 	return bResult;
 }
@@ -132,31 +317,99 @@ bool OilerClass::AddMotor ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint
 bool OilerClass::AddMotor ( uint8_t uiPin, uint8_t uiWorkPin, uint8_t uiWorkTarget )
 {
 	bool bResult = false;
-	if ( m_Motors.uiNumMotors < MAX_MOTORS /* && digitalPinToInterrupt (uiWorkPin) != NOT_AN_INTERRUPT */ )
+	if ( m_Motors.uiNumMotors < MAX_MOTORS && ClaimWorkPin ( uiWorkPin ) )
 	{
-		// space to add another motor
-		m_Motors.MotorInfo [ m_Motors.uiNumMotors ].Motor = (MotorClass *)new RelayMotorClass  ( uiPin );
-		SetupMotorPins ( uiWorkPin, uiWorkTarget );
-/*
+		// space to add another motor and its sensor is monitored
+		bResult = SetupMotor ( TheMotors.AddRelayMotor ( uiPin ) != NULL, uiWorkPin, uiWorkTarget );
+	}
+	return bResult;
+}
+
+bool OilerClass::AddMotor ( uint8_t uiDirPin, uint32_t ulSpeed, uint16_t uiRampSteps, uint8_t uiWorkPin, uint8_t uiWorkTarget )
+{
+	bool bResult = false;
+	if ( m_Motors.uiNumMotors < MAX_MOTORS && StepDirMotorClass::IsFree () && ClaimWorkPin ( uiWorkPin ) )
+	{
+		// space to add another motor, the STEP pin isn't taken and its sensor is monitored
+		StepDirMotorClass* pMotor = TheMotors.AddStepDirMotor ( uiDirPin, ulSpeed );
+		if ( pMotor != NULL )
+		{
+			pMotor->SetRamp ( STEPDIR_RAMP_START_SPEED, uiRampSteps );
+		}
+		bResult = SetupMotor ( pMotor != NULL, uiWorkPin, uiWorkTarget );
+	}
+	return bResult;
+}
+
+bool OilerClass::AddMotor ( uint8_t uiPin, uint8_t uiSpeed, uint8_t uiWorkPin, uint8_t uiWorkTarget )
+{
+	bool bResult = false;
+	if ( m_Motors.uiNumMotors < MAX_MOTORS && PWMMotorClass::IsPWMPin ( uiPin ) && ClaimWorkPin ( uiWorkPin ) )
+	{
+		// space to add another motor, the pin has PWM and its sensor is monitored
+		bResult = SetupMotor ( TheMotors.AddPWMMotor ( uiPin, uiSpeed ) != NULL, uiWorkPin, uiWorkTarget );
+	}
+	return bResult;
+}
+
+// Each motor's sensor pin gets its own filter state in PCIHandler. The pin is claimed before the motor is built, as motors can't be removed
+// from TheMotors, so a pin that can't be monitored leaves nothing behind. Until the motor is set up its drips are ignored by CountWork
+bool OilerClass::ClaimWorkPin ( uint8_t uiWorkPin )
+{
+	return PCIHandler.AddPin ( uiWorkPin, MotorISRs::MotorWorkCallback [ m_Motors.uiNumMotors ], MOTOR_WORK_SIGNAL_MODE, MOTOR_WORK_SIGNAL_PINMODE, &DripFilter );
+}
+
+// Completes adding the motor TheMotors added last, or gives back the sensor pin if TheMotors had no room for it
+bool OilerClass::SetupMotor ( bool bAdded, uint8_t uiWorkPin, uint8_t uiWorkTarget )
+{
+	if ( bAdded )
+	{
+		m_Motors.MotorInfo [ m_Motors.uiNumMotors ].uiMotor = TheMotors.GetLastAdded ();
 		m_Motors.MotorInfo [ m_Motors.uiNumMotors ].uiWorkPin = uiWorkPin;
-		m_Motors.MotorInfo [ m_Motors.uiNumMotors ].uiWorkTarget = uiWorkTarget;
-		pinMode ( uiWorkPin, MOTOR_WORK_SIGNAL_PINMODE );
-		attachInterrupt ( digitalPinToInterrupt ( uiWorkPin ), MotorISRs.MotorWorkCallback [ m_Motors.uiNumMotors ], MOTOR_WORK_SIGNAL_MODE );
+		m_Motors.MotorInfo [ m_Motors.uiNumMotors ].uiWorkTarget = uiWorkTarget > 0 ? uiWorkTarget : 1;
+		m_Motors.MotorInfo [ m_Motors.uiNumMotors ].uiWorkCount = 0;
+		m_Motors.MotorInfo [ m_Motors.uiNumMotors ].ullDue = 0;
 		m_Motors.uiNumMotors++;
-*/
+	}
+	else
+	{
+		PCIHandler.RemovePin ( uiWorkPin );
+	}
+	return bAdded;
+}
+
+bool OilerClass::SetMotorWorkTarget ( uint8_t uiMotorIndex, uint8_t uiWorkTarget )
+{
+	bool bResult = false;
+
+	if ( uiMotorIndex < m_Motors.uiNumMotors && uiWorkTarget > 0 )
+	{
+		m_Motors.MotorInfo [ uiMotorIndex ].uiWorkTarget = uiWorkTarget;
 		bResult = true;
 	}
 	return bResult;
 }
 
-void OilerClass::SetupMotorPins ( uint8_t uiWorkPin, uint8_t uiWorkTarget )
+// The pin is added again with the new filter, which also clears the filter's state
+bool OilerClass::SetMotorFilter ( uint8_t uiMotorIndex, const PIN_FILTER* pFilter )
 {
-	m_Motors.MotorInfo [ m_Motors.uiNumMotors ].uiWorkPin = uiWorkPin;
-	m_Motors.MotorInfo [ m_Motors.uiNumMotors ].uiWorkTarget = uiWorkTarget;
-	//pinMode ( uiWorkPin, MOTOR_WORK_SIGNAL_PINMODE );
-	//attachInterrupt ( digitalPinToInterrupt ( uiWorkPin ), MotorISRs.MotorWorkCallback [ m_Motors.uiNumMotors ], MOTOR_WORK_SIGNAL_MODE );
-	PCIHandler.AddPin ( uiWorkPin, MotorISRs.MotorWorkCallback [ m_Motors.uiNumMotors ], MOTOR_WORK_SIGNAL_MODE, MOTOR_WORK_SIGNAL_PINMODE );
-	m_Motors.uiNumMotors++;
+	bool bResult = false;
+
+	if ( uiMotorIndex < m_Motors.uiNumMotors )
+	{
+		uint8_t		uiWorkPin	= m_Motors.MotorInfo [ uiMotorIndex ].uiWorkPin;
+		PIN_FILTER	OldFilter;
+		bool		bFiltered	= PCIHandler.GetPinFilter ( uiWorkPin, &OldFilter );
+
+		PCIHandler.RemovePin ( uiWorkPin );
+		bResult = PCIHandler.AddPin ( uiWorkPin, MotorISRs::MotorWorkCallback [ uiMotorIndex ], MOTOR_WORK_SIGNAL_MODE, MOTOR_WORK_SIGNAL_PINMODE, pFilter );
+		if ( !bResult )
+		{
+			// no filter state free for the new one, put the sensor back as it was rather than leave the motor unmonitored
+			PCIHandler.AddPin ( uiWorkPin, MotorISRs::MotorWorkCallback [ uiMotorIndex ], MOTOR_WORK_SIGNAL_MODE, MOTOR_WORK_SIGNAL_PINMODE, bFiltered ? &OldFilter : NULL );
+		}
+	}
+	return bResult;
 }
 
 void	OilerClass::AddMachine ( TargetMachineClass* pMachine )
@@ -179,36 +432,6 @@ bool	OilerClass::SetAlert ( uint8_t uiAlertPin, uint32_t ulAlertMultiple )
 	return bResult;
 }
 
-void OilerClass::MotorWork ( uint8_t uiMotorIndex )
-{
-	// One of Oiler motors has completed work
-	m_Motors.MotorInfo[ uiMotorIndex ].uiWorkCount++;
-	// check if it has hit target
-	if ( m_Motors.MotorInfo [ uiMotorIndex ].uiWorkCount >= NUM_MOTOR_WORK_EVENTS )
-	{
-		// hit target, stop motor
-		m_Motors.MotorInfo [ uiMotorIndex ].Motor->Off ();
-
-		// have we stopped all motors
-		if ( AllMotorsStopped() )
-		{	
-			ClearError ();
-			// restart monitoring, if we have a machine
-			if ( m_pMachine != NULL && m_OilerMode != ON_TIME )
-			{
-				m_pMachine->RestartMonitoring ();
-				m_timeOilerStopped = millis ();
-			}
-			// reset start time count
-			if ( m_OilerMode == ON_TIME )
-			{
-				m_timeOilerStopped = millis ();
-			}
-			m_OilerStatus = IDLE;
-		}
-	}
-}
-
 OilerClass::eStartMode OilerClass::GetStartMode ( void )
 {
 	return m_OilerMode;
@@ -219,53 +442,6 @@ OilerClass::eStatus OilerClass::GetStatus ( void )
 	return m_OilerStatus;
 }
 
-void OilerClass::CheckTargetReady ( void )
-{
-	static uint32_t ulOilingFailed = 0;
-
-	switch  ( m_OilerMode )
-	{
-		case ON_TARGET_ACTIVITY:
-			if ( m_pMachine->MachineUnitsDone() )
-			{
-				if ( m_OilerStatus == OILING )
-				{
-					// Still Oiling and machine is ready for more oil - one or more motors isn't outputting in time
-					ulOilingFailed++;
-					CheckError ( ulOilingFailed, 1 );
-				}
-				else
-				{
-					ulOilingFailed = 0;
-				}
-				On ();
-				m_pMachine->RestartMonitoring ();
-			}
-			break;
-
-		case ON_POWERED_TIME:
-			if ( m_pMachine->MachinePoweredTimeExpired () )
-			{
-				if ( m_OilerStatus == OILING )
-				{
-					// Still Oiling and machine is ready for more oil - one or more motors isn't outputting in time
-					ulOilingFailed++;
-					CheckError ( ulOilingFailed, 1 );
-				}
-				else
-				{
-					ulOilingFailed = 0;
-				}
-				On ();
-				m_pMachine->RestartMonitoring ();
-			}
-			break;
-
-		default:		// do nothing, shouldn't get here
-			break;
-	}
-}
-
 // returns time since Oiler went idle in seconds
 uint32_t OilerClass::GetTimeOilerIdle ( void )
 {
@@ -274,7 +450,7 @@ uint32_t OilerClass::GetTimeOilerIdle ( void )
 	// if no oiler motors pumping
 	if ( AllMotorsStopped () && GetStatus() != OFF )
 	{
-		ulResult = ( millis () - m_timeOilerStopped ) / 1000;
+		ulResult = TheTimer.ElapsedSecs ( m_timeOilerStopped );
 	}
 	return ulResult;
 }
@@ -284,39 +460,100 @@ uint32_t OilerClass::GetTimeSinceMotorStarted ( uint8_t uiMotorIndex )
 	uint32_t ulResult = 0;
 	if ( uiMotorIndex < m_Motors.uiNumMotors )
 	{
-		ulResult = m_Motors.MotorInfo [ uiMotorIndex ].Motor->GetTimeMotorRunning ();
+		ulResult = TheMotors.GetMotor ( m_Motors.MotorInfo [ uiMotorIndex ].uiMotor )->GetTimeMotorRunning ();
 	}
 	return ulResult;
 }
 
-// called by timer callback when in ON_TIME mode to restart oiler motors if necessary
-void OilerClass::CheckElapsedTime ()
+uint32_t OilerClass::GetMotorEnergisedSecs ( uint8_t uiMotorIndex )
+{
+	uint32_t ulResult = 0;
+	if ( uiMotorIndex < m_Motors.uiNumMotors )
+	{
+		ulResult = TheMotors.GetMotor ( m_Motors.MotorInfo [ uiMotorIndex ].uiMotor )->GetEnergisedSecs ();
+	}
+	return ulResult;
+}
+
+// Given to every motor, motors that have no coils to manage ignore it and steppers only take it while stopped
+void OilerClass::SetPowerPolicy ( const POWER_POLICY& Policy )
+{
+	for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
+	{
+		TheMotors.SetPowerPolicy ( m_Motors.MotorInfo [ i ].uiMotor, Policy );
+	}
+}
+
+// The earliest motor deadline has passed. In ON_TIME mode a stopped motor is due to be restarted and a running one has been running for
+// the alert multiple of the oiling interval
+void OilerClass::ServeDeadlines ( void )
 {
-	// check if motor should be restarted
-	if ( GetStatus () != OFF )
+	if ( m_OilerMode == ON_TIME )
 	{
-		if ( m_Motors.uiNumMotors > 0 )
+		uint64_t	tNow		= TheTimer.GetTicks ();
+		bool		bStarted	= false;
+
+		for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
 		{
-			uint32_t tNow = millis ();
-			for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
+			if ( m_Motors.MotorInfo [ i ].ullDue != 0 && m_Motors.MotorInfo [ i ].ullDue <= tNow )
 			{
-				// check if motor not running
-				if ( m_Motors.MotorInfo [ i ].Motor->GetMotorState () == MotorClass::STOPPED )
+				if ( TheMotors.GetMotorState ( m_Motors.MotorInfo [ i ].uiMotor ) == MotorClass::STOPPED )
 				{
-					// check elapsed time
-					if ( ( tNow - m_Motors.MotorInfo [ i ].Motor->GetTimeMotorStopped () ) / 1000 > m_ulOilTime )
-					{
-						m_Motors.MotorInfo [ i ].Motor->On ();
-						m_Motors.MotorInfo [ i ].uiWorkCount = 0;
-					}
+					StartMotor ( i );
+					bStarted = true;
 				}
 				else
 				{
-					// Check motor not running beyond expected time
-					CheckError ( m_Motors.MotorInfo [ i ].Motor->GetTimeMotorRunning (), m_ulOilTime );
+					// motor not outputting in expected time
+					RaiseError ();
+					m_Motors.MotorInfo [ i ].ullDue = 0;
 				}
 			}
 		}
+		if ( bStarted )
+		{
+			FollowUp ( OILER_MOTOR_STARTED );
+		}
+	}
+	ArmDeadline ();
+}
+
+// In ON_TIME mode a running motor is next due when it should have finished, if alerts are on
+void OilerClass::StartMotor ( uint8_t uiMotorIndex )
+{
+	TheMotors.On ( m_Motors.MotorInfo [ uiMotorIndex ].uiMotor );
+	m_Motors.MotorInfo [ uiMotorIndex ].uiWorkCount = 0;
+	m_Motors.MotorInfo [ uiMotorIndex ].ullDue = 0;
+	if ( m_OilerMode == ON_TIME && m_ulAlertMultiple > 0 )
+	{
+		m_Motors.MotorInfo [ uiMotorIndex ].ullDue = TheTimer.GetTicks () + TheTimer.SecsToTicks ( m_ulOilTime * m_ulAlertMultiple );
+	}
+}
+
+// One TheTimer entry serves every motor's deadline, it is set for the earliest and the rest are found when it goes off
+void OilerClass::ArmDeadline ( void )
+{
+	uint64_t ullNext = 0;
+
+	if ( m_hDeadline != INVALID_TIMER )
+	{
+		TheTimer.RemoveTimer ( m_hDeadline );
+		m_hDeadline = INVALID_TIMER;
+	}
+	for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
+	{
+		if ( m_Motors.MotorInfo [ i ].ullDue != 0 && ( ullNext == 0 || m_Motors.MotorInfo [ i ].ullDue < ullNext ) )
+		{
+			ullNext = m_Motors.MotorInfo [ i ].ullDue;
+		}
+	}
+	if ( ullNext != 0 )
+	{
+		// long waits are capped well inside the timer's 32 bit range, nothing is due when it goes off so it is just set again
+		uint64_t tNow		= TheTimer.GetTicks ();
+		uint64_t ullWait	= ullNext > tNow ? ullNext - tNow : 1;
+
+		m_hDeadline = TheTimer.AddTimer ( OilerDeadlineCallback, ullWait < 0x7FFFFFFFUL ? ( uint32_t ) ullWait : 0x7FFFFFFFUL, TimerClass::ONE_SHOT );
 	}
 }
 
@@ -327,14 +564,19 @@ void	OilerClass::CheckError ( uint32_t ulActual, uint32_t ulTarget )
 		if ( ulActual >= ulTarget * m_ulAlertMultiple )
 		{
 			// Serial.print ( "Actual " ); Serial.print ( ulActual ); Serial.print ( " Target " ); Serial.println ( ulTarget );
-			if ( m_uiAlertPin != NOT_A_PIN )
-			{
-				digitalWrite ( m_uiAlertPin, ALERT_PIN_ERROR_STATE );
-			}
+			RaiseError ();
 		}
 	}
 }
 
+void	OilerClass::RaiseError ( void )
+{
+	if ( m_uiAlertPin != NOT_A_PIN )
+	{
+		digitalWrite ( m_uiAlertPin, ALERT_PIN_ERROR_STATE );
+	}
+}
+
 void	OilerClass::ClearError ( void )
 {
 	if ( m_uiAlertPin != NOT_A_PIN )
@@ -358,7 +600,7 @@ MotorClass::eState OilerClass::GetMotorState ( uint8_t uiMotorNum )
 	MotorClass::eState eResult = MotorClass::STOPPED;
 	if ( uiMotorNum < m_Motors.uiNumMotors )
 	{
-		eResult = m_Motors.MotorInfo [ uiMotorNum ].Motor->GetMotorState ();
+		eResult = TheMotors.GetMotorState ( m_Motors.MotorInfo [ uiMotorNum ].uiMotor );
 	}
 	return eResult;
 }
@@ -368,7 +610,7 @@ bool OilerClass::AllMotorsStopped ( void )
 	bool bResult = true;
 	for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
 	{
-		if ( m_Motors.MotorInfo [ i ].Motor->GetMotorState() == MotorClass::RUNNING )
+		if ( TheMotors.GetMotorState ( m_Motors.MotorInfo [ i ].uiMotor ) == MotorClass::RUNNING )
 		{
 			bResult = false;
 			break;
@@ -379,7 +621,9 @@ bool OilerClass::AllMotorsStopped ( void )
 
 bool OilerClass::SetStartMode ( eStartMode Mode, uint32_t ulModeTarget )
 {
-	bool bResult = false;
+	bool		bResult	= false;
+	eStartMode	OldMode	= m_OilerMode;
+
 	switch ( Mode )
 	{
 		case ON_TIME:
@@ -415,15 +659,56 @@ bool OilerClass::SetStartMode ( eStartMode Mode, uint32_t ulModeTarget )
 		default:
 			break;
 	}
+	// the motors' deadlines and the machine's ready handler are otherwise only set up when the motors start
+	if ( bResult && Mode != OldMode && m_OilerStatus != OFF )
+	{
+		ChangeMode ( OldMode );
+	}
 	return bResult;
 }
 
+// ON_TIME motors that are stopped are due after the oiling interval from now, running ones get an alert deadline as if they had just
+// started. Other modes have no motor deadlines and the machine reports when it is ready, counting from now if it was not being watched
+void OilerClass::ChangeMode ( eStartMode OldMode )
+{
+	uint64_t tNow = TheTimer.GetTicks ();
+
+	for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
+	{
+		m_Motors.MotorInfo [ i ].ullDue = 0;
+		if ( m_OilerMode == ON_TIME )
+		{
+			if ( TheMotors.GetMotorState ( m_Motors.MotorInfo [ i ].uiMotor ) == MotorClass::STOPPED )
+			{
+				m_Motors.MotorInfo [ i ].ullDue = tNow + TheTimer.SecsToTicks ( m_ulOilTime );
+			}
+			else if ( m_ulAlertMultiple > 0 )
+			{
+				m_Motors.MotorInfo [ i ].ullDue = tNow + TheTimer.SecsToTicks ( m_ulOilTime * m_ulAlertMultiple );
+			}
+		}
+	}
+	ArmDeadline ();
+	if ( m_pMachine != NULL )
+	{
+		if ( m_OilerMode == ON_TIME )
+		{
+			m_pMachine->SetReadyHandler ( NULL );
+		}
+		else if ( OldMode == ON_TIME )
+		{
+			m_pMachine->SetReadyHandler ( MachineReadyHandler );
+			m_pMachine->RestartMonitoring ();
+		}
+	}
+}
+
 // Set direction of specified motor 
 void OilerClass::SetMotorsForward ( uint8_t uiMotorIndex )
 {
-	for ( uint8_t i = 0; i < m_Motors.uiNumMotors; i++ )
+	if ( uiMotorIndex < m_Motors.uiNumMotors )
 	{
-		m_Motors.MotorInfo [ i ].Motor->SetDirection ( MotorClass::FORWARD );
+		TheMotors.SetDirection ( m_Motors.MotorInfo [ uiMotorIndex ].uiMotor, MotorClass::FORWARD );
 	}
 }
 
@@ -439,8 +724,20 @@ void OilerClass::SetMotorsForward ( void )
 // Set direction of specified motor 
 void OilerClass::SetMotorsBackward ( uint8_t uiMotorIndex )
 {
+	if ( uiMotorIndex < m_Motors.uiNumMotors )
+	{
+		TheMotors.SetDirection ( m_Motors.MotorInfo [ uiMotorIndex ].uiMotor, MotorClass::BACKWARD );
+	}
+}
 
-	m_Motors.MotorInfo [ uiMotorIndex ].Motor->SetDirection ( MotorClass::BACKWARD );
+bool OilerClass::SetMotorSpeed ( uint8_t uiMotorIndex, uint32_t ulSpeed )
+{
+	bool bResult = false;
+	if ( uiMotorIndex < m_Motors.uiNumMotors )
+	{
+		bResult = TheMotors.SetSpeed ( m_Motors.MotorInfo [ uiMotorIndex ].uiMotor, ulSpeed );
+	}
+	return bResult;
 }
 
 // Set all motors in specified direction
@@ -23,6 +23,26 @@
 //
 //	Ver 0.6 14/6/21	Added functionality to optionally specify pin to signalled if oiler has not oiled in multiple of target mode threshold eg twice elapsed time or three times spindle revs
 //
+//	Ver 0.7			Timer and motor sensor interrupts now only queue work on TheWorkQueue, oiler logic runs when the sketch loop calls TheWorkQueue.Dispatch
+//					Drip sensor debounce is done by a PCIHandler pin filter rather than in each motor's interrupt routine
+//					Motor, oiler and machine times are kept as 64 bit TheTimer ticks so they no longer wrap after 49 days of uptime
+//					Inputs expected to signal fast are given INT0 or INT1 instead of a pin change interrupt if wired to D2 or D3
+//					PCIHandler pins can be removed, disabled or have their edge changed while running, all 20 Uno pins can be monitored
+//					Sensors can be wired to 74HC165 shift registers read by TheInputExpander
+//					Stepper motors write their pins straight to the port registers, steps due together are merged into one write per port
+//					Stepper motors can ramp up to speed and back down again, see FourPinStepperMotorClass::SetRamp
+//					All stepper motors are timed by TheStepEngine from a single timer callback
+//					Added StepDirMotorClass for A4988 / DRV8825 style drivers, STEP pulses are made by Timer1's compare output on D10
+//					Added PWMMotorClass for DC pumps with speed set as a duty cycle and a soft start, see OilerClass::SetMotorSpeed
+//					Slow stepper motors can cut or chop their coil current between steps, see POWER_POLICY, energised time is reported per motor
+//					Motors are built in a fixed arena by TheMotors and called by type rather than through virtual functions, no heap is used
+//					Stepper motors can be driven from a chain of 74HC595 shift registers written over SPI by TheOutputExpander, one burst per step tick
+//					Every motor up to MAX_MOTORS gets its own drip sensor routine and stops after its own uiWorkTarget drips
+//					Oiling is started by events rather than a once a second check, the machine posts one as it reaches a target and ON_TIME motors have deadlines
+//					Oiler state is changed only by a table driven state machine fed events from TheWorkQueue, see OilerStates.h
+//					A motor that finishes ramping down after it reached its target raises its own event so the oiler still goes idle
+//					The oiler's state machine can be checked on a PC by the tests in HostTests, see HostTests/run.sh
+//
 
 #ifndef _OILER_h
 #define _OILER_h
@@ -33,25 +53,26 @@
 	#include "WProgram.h"
 #endif
 #include "PCIHandler.h"
-#include "RelayMotor.h"
-#include "FourPinStepperMotor.h"
+#include "MotorRegistry.h"
 #include "TargetMachine.h"
+#include "OilerStates.h"
 
-#define		OILER_VERSION				0.6
+#define		OILER_VERSION				0.7
 
-#define		MAX_MOTORS					6					// MAX the oiler can support
 #define		MOTOR_WORK_SIGNAL_MODE		FALLING				// Change in signal when motor output (eg oil seen) is signalled
 #define		MOTOR_WORK_SIGNAL_PINMODE	INPUT_PULLUP
 #define		ALERT_PIN_ERROR_STATE		HIGH				// LOW or HIGH as required
 #define		TIME_BETWEEN_OILING			30					// default value  - In seconds
 #define		NUM_MOTOR_WORK_EVENTS		3					// number of motor outputs (oil drips) after which motor is stopped and restarts waiting for mode threshold to occur
 #define		DEBOUNCE_THRESHOLD			150UL				// milliseconds, increase if drip sensor is registering too many drips per single drip
+#define		DRIP_MIN_PULSE				200UL				// microseconds, sensor must be steady this long before a drip is counted, filters out glitches
+#define		DEADLINE_RETRY_TICKS		( RESOLUTION / 10 )	// TheTimer ticks, wait before posting a motor deadline again if TheWorkQueue was full
 
 class OilerClass
 {
  public:
 	enum eStartMode { ON_TIME = 0, ON_POWERED_TIME, ON_TARGET_ACTIVITY, NONE };
-	enum eStatus { OILING = 0, OFF, IDLE};						// IDLE => waiting for start event
+	enum eStatus { OILING = OILER_OILING, OFF = OILER_OFF, IDLE = OILER_IDLE };	// IDLE => waiting for start event
 	
 						OilerClass ( TargetMachineClass* pMachine = NULL );
 	bool				On ();												// Start all motors
@@ -60,15 +81,18 @@ class OilerClass
 	void				SetMotorsForward ( uint8_t uiMotorIndex );			// Set direction of specified motor
 	void				SetMotorsBackward ( void );							// Set direction of all motors
 	void				SetMotorsBackward ( uint8_t uiMotorIndex );			// set direction of specified motor
-	bool				AddMotor ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint8_t uiPin4, uint32_t ulSpeed, uint8_t uiWorkPin, uint8_t uiWorkTarget = NUM_MOTOR_WORK_EVENTS );		// FourPin Stepper version
+	bool				SetMotorSpeed ( uint8_t uiMotorIndex, uint32_t ulSpeed );	// units depend on motor type, eg percent for a PWM motor
+	bool				AddMotor ( uint8_t uiPin1, uint8_t uiPin2, uint8_t uiPin3, uint8_t uiPin4, uint32_t ulSpeed, uint8_t uiWorkPin, uint8_t uiWorkTarget = NUM_MOTOR_WORK_EVENTS, uint32_t ulRampStartSpeed = 0, uint16_t uiRampSteps = 0 );		// FourPin Stepper version, optionally ramps up from ulRampStartSpeed
 	bool				AddMotor ( uint8_t uiPin, uint8_t uiWorkPin, uint8_t uiWorkTarget = NUM_MOTOR_WORK_EVENTS );																		// one pin relay version
-	void				MotorWork ( uint8_t uiMotorIndex );					// Used internally by interrupt handler to capture signal from a motor sensor when output (oil) is seen
+	bool				AddMotor ( uint8_t uiDirPin, uint32_t ulSpeed, uint16_t uiRampSteps, uint8_t uiWorkPin, uint8_t uiWorkTarget );													// STEP / DIR driver version, STEP on D10, ramps up from STEPDIR_RAMP_START_SPEED, only one allowed
+	bool				AddMotor ( uint8_t uiPin, uint8_t uiSpeed, uint8_t uiWorkPin, uint8_t uiWorkTarget );																	// PWM DC motor version, pin 5 or 6, speed in percent, soft starts
+	bool				SetMotorWorkTarget ( uint8_t uiMotorIndex, uint8_t uiWorkTarget );	// work units (oil drips) after which the motor is stopped, at least 1
+	bool				SetMotorFilter ( uint8_t uiMotorIndex, const PIN_FILTER* pFilter );	// replaces the motor's drip sensor filter, NULL for none
+	void				HandleEvent ( uint8_t uiEvent, uint8_t uiParam );	// Used internally, runs an eOilerEvent from loop, see OilerStates.h
 	bool				SetStartMode ( eStartMode Mode, uint32_t uiModeTarget );
 	bool				SetAlert ( uint8_t uiAlertPin, uint32_t uiAlertMultiple );
 	eStartMode			GetStartMode ( void );
 	eStatus				GetStatus ( void );
-	void				CheckElapsedTime ( void );							// Checks time running since olier last finished - this is the basic version not using TargetMachine
-	void				CheckTargetReady ( void );							// Checks if target is ready for oil
 	void				AddMachine ( TargetMachineClass* pMachine );
 
 	// optionally called to inform oiler we have a target machine that can be queried
@@ -76,20 +100,43 @@ class OilerClass
 	MotorClass::eState	GetMotorState ( uint8_t uiMotorNum );				// get state of specified motor
 	uint32_t			GetTimeOilerIdle ( void );							// returns time in seconds the Oiler has been idle (all motors off)
 	uint32_t			GetTimeSinceMotorStarted ( uint8_t uiMotorIndex );	// returns time in seconds since motor started
+	uint32_t			GetMotorEnergisedSecs ( uint8_t uiMotorIndex );		// returns seconds motor has been powered over all its runs
+	void				SetPowerPolicy ( const POWER_POLICY& Policy );		// for all stepper motors, while they are stopped
 	bool				AllMotorsStopped ( void );							// true if no motors active
+	uint16_t			GetTransitionCount ( uint8_t uiState, uint8_t uiEvent );	// times eOilerEvent has been taken in eOilerState
+	uint16_t			GetRefusedCount ( void );							// events whose action refused them
+	void				Dump ( void );										// prints transition counts and queue losses to Serial
 
  protected:
 
 	 void				CheckError ( uint32_t Actual, uint32_t Target );
 	 void				ClearError ( void );
-	 void				SetupMotorPins ( uint8_t uiWorkPin, uint8_t uiWorkTarget );
+	 void				RaiseError ( void );
+	 void				StartMotor ( uint8_t uiMotorIndex );
+	 void				ArmDeadline ( void );								// sets m_hDeadline for the earliest motor deadline
+	 bool				RunAction ( uint8_t uiAction, uint8_t uiParam );	// eOilerAction, false if refused
+	 void				FollowUp ( uint8_t uiEvent );						// eOilerEvent for HandleEvent to run after the current one
+	 void				StartMotors ( void );
+	 void				StopMotors ( void );
+	 void				CountWork ( uint8_t uiMotorIndex );
+	 bool				Rest ( void );										// false if a motor is running
+	 void				ServeDeadlines ( void );
+	 void				ChangeMode ( eStartMode OldMode );					// brings deadlines and machine monitoring into line with a new mode while on
+	 bool				IsStartTarget ( uint8_t uiReason );				// machine eReadyReason is the one for the start mode
+	 bool				ClaimWorkPin ( uint8_t uiWorkPin );								// monitors the sensor of the motor about to be added
+	 bool				SetupMotor ( bool bAdded, uint8_t uiWorkPin, uint8_t uiWorkTarget );	// completes adding the motor TheMotors added last, releases the pin if not bAdded
 
 	 eStartMode				m_OilerMode;
 	 eStatus				m_OilerStatus;
 	 TargetMachineClass*	m_pMachine;
-	 uint32_t				m_timeOilerStopped;
+	 uint64_t				m_timeOilerStopped;						// TheTimer ticks
 	 uint8_t				m_uiAlertPin;								// pin to signal if Alert to be generated
 	 uint16_t				m_ulAlertMultiple;						// Multiple of metric used to restart Oiler if motors are running in excess of AlertMultiple * metric
+	 uint32_t				m_ulOilingFailed;						// times machine was ready again before oiling finished
+	 uint16_t				m_auiTransitions [ NUM_OILER_STATES ][ NUM_OILER_EVENTS ];	// times each transition was taken
+	 uint16_t				m_uiRefused;
+	 uint8_t				m_uiFollowUp;							// eOilerEvent raised by the running action, NUM_OILER_EVENTS if none
+	 TimerHandle			m_hDeadline;							// one shot for the earliest MOTOR_INFO ullDue, INVALID_TIMER if none
 	 union															// These values are mutually exclsuive so use same storage
 	 {
 		 uint32_t m_ulOilTime;
@@ -98,10 +145,11 @@ class OilerClass
 	 typedef struct
 	 {
 		 uint8_t					uiWorkPin;						// Pin that signals when motor has completed a unit of work e.g. a drip of oil
-		 MotorClass*				Motor;							// ptr to type of motor class
+		 uint8_t					uiMotor;						// index of motor in TheMotors
 		 uint16_t					uiWorkCount;					// Number of work units (oil drips) seen
 		 uint8_t					uiWorkTarget;					// Target number of work units (oil drips) from motor after which it is stopped
 		 uint16_t					uiAlertThreshold;				// if motor has been running in excess of threshold then alert will be signalled, 0 = no threshold
+		 uint64_t					ullDue;							// TheTimer ticks when a stopped motor restarts or a running one alerts, ON_TIME mode only, 0 for none
 	 } MOTOR_INFO;
 	 struct															// keep track of each motor used by oiler
 	 {
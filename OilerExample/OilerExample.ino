@@ -28,12 +28,14 @@ Currently the system supports two types of motors, a relay motor which uses the
 using a ULN2003 stepper driver and 28BYJ-48 stepper motor. This latter motor has additional features that the dc motor does not implement e.g. ability to programatically change the motor direction and the ability to alter the speed. For the
 relay motor changing direction would be a wiring change at project setup.
 
-Since the code uses a timer to monitor progress there is no need for a user to call any special function in the arduino loop function or worry that the loop is taking a long time and impacting the oiler processing. The loop is free for other
-uses such as a user interface to monitor and control TheOiler.
+The code uses a timer and pin change interrupts to monitor progress, these queue the oiler work on an object called TheWorkQueue rather than doing it inside the
+interrupt. The arduino loop function needs to call TheWorkQueue.Dispatch regularly to run that work, other than this the loop is free for other uses such as a
+user interface to monitor and control TheOiler. In this example the loop just calls TheScheduler.Run, which runs the work queue, the command handling and the screen
+updates as separate tasks each with a time budget.
 The arduino setup function should be used to add motors to TheOiler, attach TheMachine to TheOiler, if TheMachine inputs are implemented in the project install, and finally turn TheOiler on.
 
 In this example there is code to demonstrate adding a 4 pin stepper motor, starting the oiler, changing direction, using inputs from 'TheMachine' to start the oiler after spindle revolutions or elapsed powered on time. A rudimentary system monitor
-and user interface is implemented in the loop function. This uses ANSI terminal control sequences (see https://en.wikipedia.org/wiki/ANSI_escape_code#Fe_Escape_sequences). To benefit from this connect to the Arduino serial port using a better terminal
+and user interface is implemented as tasks run from the loop function. This uses ANSI terminal control sequences (see https://en.wikipedia.org/wiki/ANSI_escape_code#Fe_Escape_sequences). To benefit from this connect to the Arduino serial port using a better terminal
 monitor than the default one that comes with the arduino IDE. This was tested with the free version of PuTTY. Note to use this download the ketch to the arduino and take note of the port the arduino is on. Start your emaulator and connect to that port at 
 the baud rate  used in the sketch (currently 19200) and off you go. Note that if you want to download the sketch again you will have to stop the terminal emulator so the arduino IDE can gain access.
 
@@ -43,20 +45,58 @@ the baud rate  used in the sketch (currently 19200) and off you go. Note that if
 #include "RelayMotor.h"
 #include "Configuration.h"
 #include "Oiler.h"
+#include "WorkQueue.h"
+#include "Profiler.h"
+#include "Scheduler.h"
+#include "InputExpander.h"
+#include "OutputExpander.h"
+
+// the motors set up in Configuration.h must fit in TheMotors
+#if defined USING_STEPDIR_MOTOR
+static_assert ( sizeof ( StepDirMotorClass ) <= MOTOR_ARENA_BYTES, "STEP / DIR motor doesn't fit in MOTOR_ARENA_BYTES" );
+#elif defined USING_STEPPER_MOTORS
+static_assert ( NUM_MOTORS <= MAX_MOTORS && NUM_MOTORS * sizeof ( FourPinStepperMotorClass ) <= MOTOR_ARENA_BYTES, "NUM_MOTORS four pin steppers don't fit in TheMotors, see MAX_MOTORS" );
+#elif defined USING_PWM_MOTORS
+static_assert ( NUM_MOTORS <= MAX_MOTORS && NUM_MOTORS * sizeof ( PWMMotorClass ) <= MOTOR_ARENA_BYTES, "NUM_MOTORS PWM motors don't fit in TheMotors, see MAX_MOTORS" );
+#else
+static_assert ( NUM_MOTORS <= MAX_MOTORS && NUM_MOTORS * sizeof ( RelayMotorClass ) <= MOTOR_ARENA_BYTES, "NUM_MOTORS relay motors don't fit in TheMotors, see MAX_MOTORS" );
+#endif
 
-int8_t uiDebugPort;
-int8_t uiDebugMask;
-int8_t uiDebugPin;
-uint8_t bPCICount = 0;
+bool bShowingTimings = false;										// timings screen is up, stats are not drawn over it
 
 void setup ()
 {
 	Serial.begin ( 19200 );
 	while ( !Serial );
 	ClearScreen ();
+#ifdef ISR_PROFILING
+	TheProfiler.Begin ();
+#endif
+#if EXPANDER_CHIPS > 0
+	// must be started before any sensor using an expander input is added
+	if ( TheInputExpander.Begin ( EXPANDER_LOAD_PIN, EXPANDER_CHIPS ) == false )
+	{
+		Error ( F ( "Unable to start input expander, stopped" ) );
+		while ( 1 );
+	}
+#endif
+#if OUTPUT_EXPANDER_CHIPS > 0
+	// must be started before any motor using an expander output is added
+	if ( TheOutputExpander.Begin ( OUTPUT_LATCH_PIN, OUTPUT_EXPANDER_CHIPS ) == false )
+	{
+		Error ( F ( "Unable to start output expander, stopped" ) );
+		while ( 1 );
+	}
+#endif
 
 	// Add motors to Oiler - see Configuration.h
-#ifdef USING_STEPPER_MOTORS
+#if defined USING_STEPDIR_MOTOR
+	if ( TheOiler.AddMotor ( StepDirMotor [ 0 ].DirPin, StepDirMotor [ 0 ].Speed, StepDirMotor [ 0 ].RampSteps, StepDirMotor [ 0 ].MotorOutputPin, StepDirMotor [ 0 ].Drips ) == false )
+	{
+		Error ( F ( "Unable to add motor to oiler, stopped" ));
+		while ( 1 );
+	}
+#elif defined USING_STEPPER_MOTORS
 	/* For the purpose of showing how this is done, the next two commented out lines work but the following loop is more elegant 
 	TheOiler.AddMotor ( 4, 5, 6, 7, 800, 2, 3 );
 	TheOiler.AddMotor ( 8, 9, 10, 11, 800, 3, 4 );
@@ -69,7 +109,9 @@ void setup ()
 								 FourPinMotor [ i ].Pin4, 
 								 FourPinMotor [ i ].Speed , 
 								 FourPinMotor [ i ].MotorOutputPin,
-								 FourPinMotor [ i ].Drips
+								 FourPinMotor [ i ].Drips,
+								 FourPinMotor [ i ].RampStartSpeed,
+								 FourPinMotor [ i ].RampSteps
 							   ) == false 
 		   )
 		{
@@ -77,9 +119,19 @@ void setup ()
 			while ( 1 );
 		}
 	}
+	TheOiler.SetPowerPolicy ( StepperPower );
 	/*
 	*		Example using relays to drive a dc motor
 	*/
+#elif defined USING_PWM_MOTORS
+	for ( uint8_t i = 0; i < NUM_MOTORS; i++ )
+	{
+		if ( TheOiler.AddMotor ( PWMMotor [ i ].Pin1, PWMMotor [ i ].Speed, PWMMotor [ i ].MotorOutputPin, PWMMotor [ i ].Drips ) == false )
+		{
+			Error ( F ( "Unable to add motor to oiler, stopped" ));
+			while ( 1 );
+		}
+	}
 #else
 	for ( uint8_t i = 0; i < NUM_MOTORS; i++ )
 	{
@@ -123,14 +175,41 @@ void setup ()
 	//	while ( 1 );
 	//}
 	DisplayMenu ();
+
+	// The loop runs these tasks, oiler work first. Budgets are in microseconds, anything writing to the screen is held up by the 19200 baud serial port
+	TheScheduler.AddTask ( F ( "Dispatch" ), DispatchTask, 0, 0, 1000 );
+	TheScheduler.AddTask ( F ( "Commands" ), CommandTask, 50, 1, 20000 );
+	TheScheduler.AddTask ( F ( "Display " ), DisplayTask, 250, 2, 20000 );
 }
+
 void loop ()
 {
+	// everything the sketch does is run as a task, see setup
+	TheScheduler.Run ();
+}
 
-	// All work should happen in the background
-	// loop can be used to control oiler or do other functions as below
+// Runs oiler work queued by the timer and sensor interrupts
+void DispatchTask ( void )
+{
+	TheWorkQueue.Dispatch ();
+}
 
-	if ( Serial.available() > 0 ) 
+// Handles one command from the serial port
+void CommandTask ( void )
+{
+	if ( Serial.available () > 0 && bShowingTimings )
+	{
+		// any key leaves the timings screen
+		Serial.read ();
+		bShowingTimings = false;
+#ifdef ISR_PROFILING
+		TheProfiler.Reset ();
+#endif
+		TheScheduler.Reset ();
+		ClearScreen ();
+		DisplayMenu ();
+	}
+	else if ( Serial.available () > 0 )
 	{
 		switch ( Serial.read() )
 		{
@@ -194,6 +273,17 @@ void loop ()
 				}
 				break;
 
+			case '8':	// interrupt and task timings, any key returns to menu
+				bShowingTimings = true;
+				ClearScreen ();
+				AT ( 1, 1, "" );
+#ifdef ISR_PROFILING
+				TheProfiler.Dump ();
+#endif
+				TheScheduler.Dump ();
+				TheOiler.Dump ();
+				break;
+
 			case '9':
 				ClearScreen ();
 				AT ( 1, 1, "" );
@@ -205,8 +295,15 @@ void loop ()
 				break;
 		}
 	}
-	// display work units per motor
-	DisplayStats ();
+}
+
+// Updates the stats on screen
+void DisplayTask ( void )
+{
+	if ( !bShowingTimings )
+	{
+		DisplayStats ();
+	}
 }
 
 // code to draw screen
@@ -260,6 +357,7 @@ void DisplayMenu ()
 	AT ( 9, 10, F ( "5 - TIME_ONLY Mode" ) );
 	AT ( 10, 10, F ( "6 - POWERED_ON Time" ) );
 	AT ( 11, 10, F ( "7 - Machine WORK UNITS" ) );
+	AT ( 12, 10, F ( "8 - Timings" ) );
 	AT ( STATS_ROW - 1 , STATS_RESULT_COL - 14, F ( "STATS" ) );
 	AT ( STATS_ROW + 0, STATS_RESULT_COL - 14, F ( "Oiler Idle    N/A" ) );
 	AT ( STATS_ROW + 1, STATS_RESULT_COL - 14, F ( "Motor1 Units  N/A") );
@@ -297,15 +395,6 @@ void DisplayStats ( void )
 	static OilerClass::eStartMode		OilerMode				= OilerClass::NONE;
 	static OilerClass::eStatus			OilerStatus				= OilerClass::OFF;
 
-	if ( uiDebugPort != 0 )
-	{
-		ClearPartofLine ( 23, 1, 40 );
-		String sDebug = "Port " + String ( uiDebugPort ) + " Mask " + String ( uiDebugMask ) + " Pin " + String ( uiDebugPin );
-		AT ( 23, 1, sDebug );
-		uiDebugPort = 0;
-		uiDebugPin = 99;
-	}
-
 	uint32_t ulIdleSecs = TheOiler.GetTimeOilerIdle ();
 	if ( ulIdleSecs != ulLastIdleSecs )
 	{
@@ -0,0 +1,60 @@
+//
+//  OilerStates.cpp
+//
+// (c) Mark Naylor June 2021
+//
+//	The oiler's transition table, see OilerStates.h
+//
+
+#include "OilerStates.h"
+
+// one row per state, one entry per event in eOilerEvent order
+const OILER_TRANSITION OilerTransitions [ NUM_OILER_STATES ][ NUM_OILER_EVENTS ] PROGMEM =
+{
+	// OILER_OILING
+	{
+		{ OILER_OILING,	OILER_START_MOTORS		},		// OILER_START
+		{ OILER_OFF,	OILER_STOP_MOTORS		},		// OILER_STOP
+		{ OILER_OILING,	OILER_COUNT_WORK		},		// OILER_MOTOR_WORK
+		{ OILER_IDLE,	OILER_REST				},		// OILER_MOTORS_DONE
+		{ OILER_OILING,	OILER_NO_ACTION			},		// OILER_MOTOR_STARTED
+		{ OILER_OILING,	OILER_SERVE_DEADLINES	},		// OILER_DEADLINE
+		{ OILER_OILING,	OILER_OIL_LATE			},		// OILER_MACHINE_READY
+		{ OILER_IDLE,	OILER_REST				}		// OILER_MOTOR_STOPPED
+	},
+	// OILER_OFF, drips from motors still slowing down are counted, nothing starts them again
+	{
+		{ OILER_OILING,	OILER_START_MOTORS		},		// OILER_START
+		{ OILER_OFF,	OILER_NO_ACTION			},		// OILER_STOP
+		{ OILER_OFF,	OILER_COUNT_WORK		},		// OILER_MOTOR_WORK
+		{ OILER_OFF,	OILER_NO_ACTION			},		// OILER_MOTORS_DONE
+		{ OILER_OFF,	OILER_NO_ACTION			},		// OILER_MOTOR_STARTED
+		{ OILER_OFF,	OILER_NO_ACTION			},		// OILER_DEADLINE
+		{ OILER_OFF,	OILER_NO_ACTION			},		// OILER_MACHINE_READY
+		{ OILER_OFF,	OILER_NO_ACTION			}		// OILER_MOTOR_STOPPED
+	},
+	// OILER_IDLE
+	{
+		{ OILER_OILING,	OILER_START_MOTORS		},		// OILER_START
+		{ OILER_OFF,	OILER_STOP_MOTORS		},		// OILER_STOP
+		{ OILER_IDLE,	OILER_COUNT_WORK		},		// OILER_MOTOR_WORK
+		{ OILER_IDLE,	OILER_NO_ACTION			},		// OILER_MOTORS_DONE
+		{ OILER_OILING,	OILER_NO_ACTION			},		// OILER_MOTOR_STARTED
+		{ OILER_IDLE,	OILER_SERVE_DEADLINES	},		// OILER_DEADLINE
+		{ OILER_OILING,	OILER_OIL_MACHINE		},		// OILER_MACHINE_READY
+		{ OILER_IDLE,	OILER_NO_ACTION			}		// OILER_MOTOR_STOPPED
+	}
+};
+
+bool GetOilerTransition ( uint8_t uiState, uint8_t uiEvent, OILER_TRANSITION* pTransition )
+{
+	bool bResult = false;
+
+	if ( uiState < NUM_OILER_STATES && uiEvent < NUM_OILER_EVENTS )
+	{
+		pTransition->uiNextState	= pgm_read_byte ( &OilerTransitions [ uiState ][ uiEvent ].uiNextState );
+		pTransition->uiAction		= pgm_read_byte ( &OilerTransitions [ uiState ][ uiEvent ].uiAction );
+		bResult = true;
+	}
+	return bResult;
+}
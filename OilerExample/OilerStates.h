@@ -0,0 +1,67 @@
+//
+//  OilerStates.h
+//
+// (c) Mark Naylor June 2021
+//
+//	Defines the oiler's states, the events that move it between them and the table of transitions. TheOiler looks each event up in the
+//	table for its current state, runs the action given and, if the action succeeds, moves to the next state. All of the oiler's state is
+//	changed in that one place, see OilerClass::HandleEvent. An action can refuse an event it has been given, for example the machine
+//	reaching a target that isn't the one for the oiler's start mode, the state is then left as it was.
+//
+//	The table is kept in flash with PROGMEM so it uses no RAM, GetOilerTransition copies an entry out of it. Nothing here uses the Arduino
+//	core so the table can be built and checked on a PC, where PROGMEM and pgm_read_byte fall back to ordinary memory.
+//
+#ifndef _OILERSTATES_h
+#define _OILERSTATES_h
+
+#include <stdint.h>
+
+#ifdef __AVR__
+	#include <avr/pgmspace.h>
+#endif
+#ifndef PROGMEM
+	#define PROGMEM
+#endif
+#ifndef pgm_read_byte
+	#define pgm_read_byte( pAddress )	( *( const uint8_t* ) ( pAddress ) )
+#endif
+
+enum eOilerState { OILER_OILING = 0, OILER_OFF, OILER_IDLE, NUM_OILER_STATES };		// same values as OilerClass::eStatus
+
+enum eOilerEvent
+{
+	OILER_START = 0,								// user started the oiler
+	OILER_STOP,										// user stopped the oiler
+	OILER_MOTOR_WORK,								// a motor's sensor saw a unit of work (drip), parameter is the motor index
+	OILER_MOTORS_DONE,								// a motor reaching its target left none running
+	OILER_MOTOR_STARTED,							// a motor was restarted by its ON_TIME deadline
+	OILER_DEADLINE,									// the earliest ON_TIME motor deadline has passed
+	OILER_MACHINE_READY,							// the machine reached a target, parameter is its TargetMachineClass::eReadyReason
+	OILER_MOTOR_STOPPED,							// a motor that was still ramping down when it was turned off has stopped
+	NUM_OILER_EVENTS
+};
+
+enum eOilerAction
+{
+	OILER_NO_ACTION = 0,
+	OILER_START_MOTORS,								// start all motors and their deadlines, restart machine monitoring
+	OILER_STOP_MOTORS,								// stop all motors and clear their deadlines
+	OILER_COUNT_WORK,								// count the drip, stop the motor at its target
+	OILER_REST,										// all motors done, refused if one has been restarted since
+	OILER_SERVE_DEADLINES,							// restart motors that are due, alert for those still running
+	OILER_OIL_LATE,									// machine ready again while still oiling, alert and start again, refused if not the start mode's target
+	OILER_OIL_MACHINE,								// machine ready, start oiling, refused if not the start mode's target
+	NUM_OILER_ACTIONS
+};
+
+typedef struct
+{
+	uint8_t		uiNextState;						// eOilerState, taken if the action succeeds
+	uint8_t		uiAction;							// eOilerAction
+} OILER_TRANSITION;
+
+extern const OILER_TRANSITION OilerTransitions [ NUM_OILER_STATES ][ NUM_OILER_EVENTS ] PROGMEM;
+
+bool GetOilerTransition ( uint8_t uiState, uint8_t uiEvent, OILER_TRANSITION* pTransition );	// false if state or event is out of range
+
+#endif
@@ -0,0 +1,127 @@
+//
+//  OutputExpander.cpp
+//
+// (c) Mark Naylor June 2021
+//
+//	Implements writing of 74HC595 shift registers over SPI, see OutputExpander.h
+//
+
+#include "OutputExpander.h"
+#include "Profiler.h"
+
+volatile uint8_t*	OutputExpanderClass::m_puiLatchPort = NULL;
+uint8_t				OutputExpanderClass::m_uiLatchMask = 0;
+uint8_t				OutputExpanderClass::m_uiChips = 0;
+volatile uint8_t	OutputExpanderClass::m_auiFrame [ MAX_OUTPUT_CHIPS ];
+volatile uint32_t	OutputExpanderClass::m_ulFrames = 0;
+
+OutputExpanderClass::OutputExpanderClass ( void )
+{
+	for ( uint8_t i = 0; i < MAX_OUTPUT_CHIPS; i++ )
+	{
+		m_auiFrame [ i ] = 0;
+	}
+}
+
+bool OutputExpanderClass::Begin ( uint8_t uiLatchPin, uint8_t uiChips )
+{
+	bool bResult = false;
+
+	if ( m_uiChips == 0 && uiChips > 0 && uiChips <= MAX_OUTPUT_CHIPS && digitalPinToPort ( uiLatchPin ) != NOT_A_PIN )
+	{
+		digitalWrite ( uiLatchPin, LOW );											// rising edge copies the shifted bits to the outputs
+		pinMode ( uiLatchPin, OUTPUT );
+		pinMode ( SS, OUTPUT );
+		pinMode ( SCK, OUTPUT );
+		pinMode ( MOSI, OUTPUT );
+
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		m_puiLatchPort	= portOutputRegister ( digitalPinToPort ( uiLatchPin ) );
+		m_uiLatchMask	= digitalPinToBitMask ( uiLatchPin );
+		m_uiChips		= uiChips;
+		Send ();
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
+		bResult = true;
+	}
+	return bResult;
+}
+
+void OutputExpanderClass::Write ( uint8_t uiPin, uint8_t uiValue )
+{
+	volatile uint8_t* puiByte = GetFrameByte ( uiPin );
+
+	if ( puiByte != NULL )
+	{
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		if ( uiValue == LOW )
+		{
+			*puiByte &= ~( 1 << ( ( uiPin - FIRST_OUTPUT_PIN ) & 7 ) );
+		}
+		else
+		{
+			*puiByte |= ( 1 << ( ( uiPin - FIRST_OUTPUT_PIN ) & 7 ) );
+		}
+		Send ();
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
+	}
+}
+
+uint32_t OutputExpanderClass::GetFrames ( void )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	uint32_t ulResult = m_ulFrames;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return ulResult;
+}
+
+bool OutputExpanderClass::IsOutputPin ( uint8_t uiPin )
+{
+	return uiPin >= FIRST_OUTPUT_PIN && uiPin < OUTPUT_PIN ( MAX_OUTPUT_CHIPS, 0 );
+}
+
+volatile uint8_t* OutputExpanderClass::GetFrameByte ( uint8_t uiPin )
+{
+	return IsOutputPin ( uiPin ) ? &m_auiFrame [ ( uiPin - FIRST_OUTPUT_PIN ) >> 3 ] : NULL;
+}
+
+bool OutputExpanderClass::IsFrameByte ( volatile uint8_t* puiPort )
+{
+	return puiPort >= &m_auiFrame [ 0 ] && puiPort < &m_auiFrame [ MAX_OUTPUT_CHIPS ];
+}
+
+// The last chip's byte goes first as it has the furthest to shift. The SPI mode is set for each burst and put back after so TheInputExpander,
+// which needs a different one, can share the port, both only use it with interrupts off or from an interrupt
+void OutputExpanderClass::Send ( void )
+{
+	if ( m_uiChips > 0 )
+	{
+		uint8_t uiSPCR = SPCR;
+
+		// master, clock idles high and the chips shift on the rising edge half way through each bit, 4MHz
+		SPCR = ( 1 << SPE ) | ( 1 << MSTR ) | ( 1 << CPOL ) | ( 1 << CPHA );
+		for ( int8_t i = m_uiChips - 1; i >= 0; i-- )
+		{
+			SPDR = m_auiFrame [ i ];
+			while ( !( SPSR & ( 1 << SPIF ) ) );
+		}
+		*m_puiLatchPort |= m_uiLatchMask;
+		*m_puiLatchPort &= ~m_uiLatchMask;
+		SPCR = uiSPCR;
+		m_ulFrames++;
+	}
+}
+
+OutputExpanderClass TheOutputExpander;
@@ -0,0 +1,56 @@
+//
+//  OutputExpander.h
+//
+// (c) Mark Naylor June 2021
+//
+//	This class drives a chain of 74HC595 serial in, parallel out shift registers to give 8 more outputs per chip from 3 pins, so many four pin
+//	steppers can be run from one Uno. The chips are written with the hardware SPI port: SCK (D13) to every chip's SRCLK, MOSI (D11) to SER of
+//	the first chip in the chain with each chip's QH' going to the SER of the next, and a latch pin of your choice to every RCLK. OE is tied
+//	low and SRCLR high.
+//
+//	The outputs are held in RAM as a frame of one byte per chip. A four pin stepper given OUTPUT_PIN ( chip, output ) pin numbers treats its
+//	chip's frame byte as its port, so its steps are saved up and merged with the other motors' exactly as they are for real ports. When the
+//	step engine's tick has written any frame byte the whole frame is shifted out in one SPI burst and latched, so all the motors on the chain
+//	step together for the cost of one burst, about 2us per chip, rather than a pin write per coil.
+//
+//	NB while in use D10, D11 and D13 can't be used for anything else, D10 is SS and is made an output so the SPI port stays master, it can still
+//	be the STEP output of a StepDirMotorClass. The SPI port can be shared with TheInputExpander, each sets the mode it needs for its own burst.
+//	Begin must be called before any motor using the outputs is added or started
+//
+#ifndef _OUTPUTEXPANDER_h
+#define _OUTPUTEXPANDER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include <Arduino.h>
+#else
+	#include "WProgram.h"
+#endif
+
+#define		MAX_OUTPUT_CHIPS		4																	// frame bytes, one per 74HC595
+#define		FIRST_OUTPUT_PIN		96																	// pin number of first output, clear of real and expander input pins
+#define		OUTPUT_PIN( uiChip, uiOutput )	( FIRST_OUTPUT_PIN + ( uiChip ) * 8 + ( uiOutput ) )	// output 0 - 7 (QA - QH) of chip 0 - n, chip 0 is nearest the Uno
+
+class OutputExpanderClass
+{
+public:
+								OutputExpanderClass ( void );
+	bool						Begin ( uint8_t uiLatchPin, uint8_t uiChips );					// sets up SPI and clears all outputs, up to MAX_OUTPUT_CHIPS chips
+	void						Write ( uint8_t uiPin, uint8_t uiValue );						// sets one output HIGH or LOW and sends the frame, like digitalWrite
+	uint32_t					GetFrames ( void );												// frames sent
+	static bool					IsOutputPin ( uint8_t uiPin );
+	static volatile uint8_t*	GetFrameByte ( uint8_t uiPin );									// frame byte holding pin, NULL if not an output pin
+	static bool					IsFrameByte ( volatile uint8_t* puiPort );
+	static void					Send ( void );													// shifts out and latches the frame, called with interrupts off
+
+protected:
+	static volatile uint8_t*	m_puiLatchPort;													// output register and mask of the latch pin, written directly as it is pulsed every frame
+	static uint8_t				m_uiLatchMask;
+	static uint8_t				m_uiChips;														// 0 until Begin, frames aren't sent till then
+	static volatile uint8_t		m_auiFrame [ MAX_OUTPUT_CHIPS ];
+	static volatile uint32_t	m_ulFrames;
+};
+
+extern OutputExpanderClass TheOutputExpander;
+
+#endif
+
@@ -8,116 +8,546 @@
 //
 
 #include "PCIHandler.h"
+#include "Profiler.h"
+
+#define		EVENT_MASK		( CAPTURE_BUFFER_SIZE - 1 )
 
 PCIHandlerClass::PCIHandlerClass ()
 {
 }
 
 // This static function is called by a PCINT interrupt ISR
-void PCIHandlerClass::CheckPortPins ( uint8_t uiPortIdGeneratingInterrupt )
+void PCIHandlerClass::CheckPortPins ( uint8_t uiPort, uint8_t uiCurrentPCIReg )
 {
-	uint8_t uiCurrentPCIReg = *portInputRegister ( uiPortIdGeneratingInterrupt );	// Get state of pins on this port
 	// See what pins have changed
-	uint8_t uiChangedPins = uiCurrentPCIReg ^ m_PCintLastValues [ uiPortIdGeneratingInterrupt - 2 ];
-	
-	// Check if any of these pins relate to one we are montoring
-	InvokeCallback ( uiChangedPins, uiPortIdGeneratingInterrupt );
+	uint8_t uiChangedPins = uiCurrentPCIReg ^ m_PCintLastValues [ uiPort ];
 	// Save latest port values
-	m_PCintLastValues [ uiPortIdGeneratingInterrupt - 2 ] = uiCurrentPCIReg;
+	m_PCintLastValues [ uiPort ] = uiCurrentPCIReg;
+
+	// of those keep the ones that rose and want rising edges or fell and want falling edges
+	uint8_t uiFiredPins = uiChangedPins & ( ( uiCurrentPCIReg & m_PortInfo [ uiPort ].uiRisingMask ) | ( ~uiCurrentPCIReg & m_PortInfo [ uiPort ].uiFallingMask ) );
+	if ( uiChangedPins & m_PortInfo [ uiPort ].uiFilterMask )
+	{
+		uiFiredPins = Filter ( uiFiredPins, uiChangedPins & m_PortInfo [ uiPort ].uiFilterMask, uiPort );
+	}
+	if ( uiFiredPins != 0 )
+	{
+		uint8_t uiCaptureMask = m_PortInfo [ uiPort ].uiCaptureMask;
 
+		if ( uiFiredPins & uiCaptureMask )
+		{
+			Capture ( uiFiredPins & uiCaptureMask, uiPort, uiCurrentPCIReg );
+		}
+		if ( uiFiredPins & ~uiCaptureMask )
+		{
+			InvokeCallback ( uiFiredPins & ~uiCaptureMask, uiPort );
+		}
+	}
 }
-extern int8_t uiDebugPort;
-extern int8_t uiDebugMask;
-extern int8_t uiDebugPin;
-void PCIHandlerClass::InvokeCallback ( uint8_t uiChangedPins, uint8_t uiPortIdGeneratingInterrupt )
+
+// This static function is called by an INT0 or INT1 interrupt ISR, there is only one pin so no need to work out which changed
+void PCIHandlerClass::CheckExtPin ( uint8_t uiInt, uint8_t uiCurrentPCIReg )
 {
-	// check each entry to see if we need to invoke its callback
-	uiDebugPort = uiPortIdGeneratingInterrupt;
-	uiDebugMask = uiChangedPins;
-	for ( uint8_t i = 0; i < PCIData::m_uiPinCount; i++ )
+	PININFO*	pPin		= &m_PinInfo [ m_auiExtEntry [ uiInt ] ];
+	uint8_t		uiPort		= pPin->uiPinPort - FIRST_PCI_PORT;
+	uint8_t		uiFiredPins	= 1 << pPin->uiPinBit;
+
+	if ( pPin->uiFilter != NO_PIN_FILTER )
+	{
+		// interrupts on every change so the pulse width is timed, drop the edges not wanted before filtering
+		uint8_t uiChangedPins = uiFiredPins;
+		if ( ( pPin->uiMode == RISING && !( uiCurrentPCIReg & uiChangedPins ) ) || ( pPin->uiMode == FALLING && ( uiCurrentPCIReg & uiChangedPins ) ) )
+		{
+			uiFiredPins = 0;
+		}
+		uiFiredPins = Filter ( uiFiredPins, uiChangedPins, uiPort );
+	}
+	if ( uiFiredPins != 0 )
 	{
-		// if a pin on this port
-		if ( m_PinInfo [ i ].uiPinPort == uiPortIdGeneratingInterrupt )
+		if ( pPin->pCallBack == NULL )
 		{
-			// if this pin has signalled 
-			if ( uiChangedPins & digitalPinToBitMask ( m_PinInfo [ i ].uiPinNum ) )
+			Capture ( uiFiredPins, uiPort, uiCurrentPCIReg );
+		}
+		else
+		{
+			pPin->pCallBack ();
+		}
+	}
+}
+
+void PCIHandlerClass::SeedPort ( uint8_t uiPort, uint8_t uiCurrentPCIReg )
+{
+	m_PCintLastValues [ uiPort ] = uiCurrentPCIReg;
+}
+
+void PCIHandlerClass::InvokeCallback ( uint8_t uiFiredPins, uint8_t uiPort )
+{
+	// at most 8 bits to visit, unmonitored bits are never in uiFiredPins as they are not in either mask
+	for ( uint8_t uiBit = 0; uiFiredPins != 0; uiBit++, uiFiredPins >>= 1 )
+	{
+		if ( uiFiredPins & 1 )
+		{
+			m_PinInfo [ m_PortInfo [ uiPort ].auiEntry [ uiBit ] ].pCallBack ();
+		}
+	}
+}
+
+// Called for the filtered pins that changed. Every change restarts the pulse width timing, only wanted edges are checked and may be dropped
+uint8_t PCIHandlerClass::Filter ( uint8_t uiFiredPins, uint8_t uiChangedPins, uint8_t uiPort )
+{
+	uint32_t ulNow = micros ();
+
+	for ( uint8_t uiBit = 0; uiChangedPins != 0; uiBit++, uiChangedPins >>= 1 )
+	{
+		if ( uiChangedPins & 1 )
+		{
+			FILTERINFO* pFilter = &m_FilterInfo [ m_PinInfo [ m_PortInfo [ uiPort ].auiEntry [ uiBit ] ].uiFilter ];
+			uint8_t		uiMask	= 1 << uiBit;
+
+			if ( uiFiredPins & uiMask )
 			{
-				uiDebugPin = m_PinInfo [ i ].uiPinNum;
-				// if pin has changed as per required mode
-				uint8_t uiCurrentPinState = digitalRead ( m_PinInfo [ i ].uiPinNum );
-				switch ( m_PinInfo [ i ].uiMode )
+				uint32_t ulGap		= pFilter->Policy.ulMinGapus;
+				uint32_t ulInterval	= ulNow - pFilter->ulLastAccepted;
+
+				if ( pFilter->Policy.bAdaptive && pFilter->uiSamples >= ADAPTIVE_SEED_SAMPLES && ( pFilter->ulAverage >> 2 ) > ulGap )
 				{
-					case RISING:
-						if ( m_PinInfo [ i ].uiLastState == LOW && uiCurrentPinState == HIGH )
+					ulGap = pFilter->ulAverage >> 2;
+				}
+				if ( ulNow - pFilter->ulLastChange < pFilter->Policy.ulMinPulseus || ( pFilter->bSeenEdge && ulInterval < ulGap ) )
+				{
+					uiFiredPins &= ~uiMask;
+					if ( pFilter->uiRejects != 0xFFFF )
+					{
+						pFilter->uiRejects++;
+					}
+				}
+				else
+				{
+					if ( pFilter->Policy.bAdaptive && pFilter->bSeenEdge )
+					{
+						if ( pFilter->uiSamples > 0 && ulInterval / ADAPTIVE_IDLE_MULTIPLE > pFilter->ulAverage )
 						{
-							m_PinInfo [ i ].pCallBack ();
+							// idle, eg machine stopped, the rate may be different when it starts again so it is learnt again from the next interval
+							pFilter->uiSamples = 0;
 						}
-						break;
-
-					case FALLING:
-						if ( m_PinInfo [ i ].uiLastState == HIGH && uiCurrentPinState == LOW )
+						else if ( pFilter->uiSamples < ADAPTIVE_SEED_SAMPLES )
 						{
-							m_PinInfo [ i ].pCallBack ();
+							// learning, an interval far shorter than those before means they included a pause so it starts again from this one
+							if ( pFilter->uiSamples == 0 || ulInterval < pFilter->ulAverage / ADAPTIVE_IDLE_MULTIPLE )
+							{
+								pFilter->ulAverage = ulInterval;
+								pFilter->uiSamples = 1;
+							}
+							else
+							{
+								pFilter->ulAverage = ( pFilter->ulAverage >> 1 ) + ( ulInterval >> 1 );
+								pFilter->uiSamples++;
+							}
 						}
-						break;
-
-					case CHANGE:
-						m_PinInfo [ i ].pCallBack ();
-						break;
+						else
+						{
+							// a shorter pause is limited to twice the average so it only nudges it up
+							if ( ulInterval > pFilter->ulAverage << 1 )
+							{
+								ulInterval = pFilter->ulAverage << 1;
+							}
+							pFilter->ulAverage = pFilter->ulAverage - ( pFilter->ulAverage >> 3 ) + ( ulInterval >> 3 );
+						}
+					}
+					pFilter->ulLastAccepted = ulNow;
+					pFilter->bSeenEdge = true;
+				}
+			}
+			pFilter->ulLastChange = ulNow;
+		}
+	}
+	return uiFiredPins;
+}
 
-					default:
-						// ignore
-						break;
+// Only interrupt routines write to the buffer and they can't interrupt each other, so there is a single producer. The slot is filled before
+// the head is moved on so ReadEvents never sees a part written event
+void PCIHandlerClass::Capture ( uint8_t uiFiredPins, uint8_t uiPort, uint8_t uiCurrentPCIReg )
+{
+	uint32_t ulNow = micros ();
 
-				}
-				m_PinInfo [ i ].uiLastState = uiCurrentPinState;
+	for ( uint8_t uiBit = 0; uiFiredPins != 0; uiBit++, uiFiredPins >>= 1 )
+	{
+		if ( uiFiredPins & 1 )
+		{
+			uint8_t uiNext = ( m_uiEventHead + 1 ) & EVENT_MASK;
+			if ( uiNext != m_uiEventTail )
+			{
+				volatile EDGE_EVENT* pEvent = &m_aEvents [ m_uiEventHead ];
+				pEvent->uiPin		= m_PinInfo [ m_PortInfo [ uiPort ].auiEntry [ uiBit ] ].uiPinNum;
+				pEvent->uiEdge		= ( uiCurrentPCIReg & ( 1 << uiBit ) ) ? RISING : FALLING;
+				pEvent->ulMicros	= ulNow;
+				m_uiEventHead		= uiNext;
+			}
+			else if ( m_uiCaptureOverflows != 0xFFFF )
+			{
+				m_uiCaptureOverflows++;
 			}
 		}
 	}
 }
 
+// Single consumer, call from loop only. The slot is copied before the tail is moved on to free it
+uint8_t PCIHandlerClass::ReadEvents ( EDGE_EVENT* pEvents, uint8_t uiMaxEvents )
+{
+	uint8_t uiCount = 0;
+	uint8_t uiTail	= m_uiEventTail;
+
+	while ( uiCount < uiMaxEvents && uiTail != m_uiEventHead )
+	{
+		pEvents [ uiCount ].uiPin		= m_aEvents [ uiTail ].uiPin;
+		pEvents [ uiCount ].uiEdge		= m_aEvents [ uiTail ].uiEdge;
+		pEvents [ uiCount ].ulMicros	= m_aEvents [ uiTail ].ulMicros;
+		uiCount++;
+		uiTail = ( uiTail + 1 ) & EVENT_MASK;
+		m_uiEventTail = uiTail;
+	}
+	return uiCount;
+}
+
+uint8_t PCIHandlerClass::GetEventCount ( void )
+{
+	return ( m_uiEventHead - m_uiEventTail ) & EVENT_MASK;
+}
+
+uint16_t PCIHandlerClass::GetCaptureOverflows ( void )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	uint16_t uiResult = m_uiCaptureOverflows;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return uiResult;
+}
+
 // Pin Change Interrupt routines, Arduino Uno mcu has 3 ports each handles a different set of pins and each port can generate a unique interrupt for the pins it covers
+// The input register is read straight away so the callbacks see the pin states that caused the interrupt
 ISR ( PCINT0_vect )
 {
-	PCIHandlerClass::CheckPortPins ( 2 );		// Port 2 interrupted
+	PROFILE_ISR_START ();
+	PCIHandlerClass::CheckPortPins ( 0, PINB );		// Port B interrupted
+	PROFILE_ISR_END ( PROFILE_PCINT0 );
 }
 ISR ( PCINT1_vect )
 {
-	PCIHandlerClass::CheckPortPins ( 3 );		// Port 3 interrupted
+	PROFILE_ISR_START ();
+	PCIHandlerClass::CheckPortPins ( 1, PINC );		// Port C interrupted
+	PROFILE_ISR_END ( PROFILE_PCINT1 );
 }
 ISR ( PCINT2_vect )
 {
-	PCIHandlerClass::CheckPortPins ( 4 );		// Port 4 interrupted
+	PROFILE_ISR_START ();
+	PCIHandlerClass::CheckPortPins ( 2, PIND );		// Port D interrupted
+	PROFILE_ISR_END ( PROFILE_PCINT2 );
+}
+
+// External interrupts, only pins routed to them by AddEntry enable these. Both are on port D on the Uno
+ISR ( INT0_vect )
+{
+	PROFILE_ISR_START ();
+	PCIHandlerClass::CheckExtPin ( 0, PIND );
+	PROFILE_ISR_END ( PROFILE_INT0 );
+}
+ISR ( INT1_vect )
+{
+	PROFILE_ISR_START ();
+	PCIHandlerClass::CheckExtPin ( 1, PIND );
+	PROFILE_ISR_END ( PROFILE_INT1 );
 }
 
 PCIHandlerClass  PCIHandler;
-volatile uint8_t PCIHandlerClass::m_PCintLastValues [ NUM_PCI_PORTS ];
+volatile uint8_t PCIData::m_PCintLastValues [ NUM_PORTS ];
 uint8_t	PCIData::m_uiPinCount = 0;
 PCIData::PININFO PCIData::m_PinInfo [ MAX_PCI_PINS ];
+PCIData::PORTINFO PCIData::m_PortInfo [ NUM_PORTS ];
+PCIData::FILTERINFO PCIData::m_FilterInfo [ MAX_PIN_FILTERS ];
+uint8_t PCIData::m_uiFilterCount = 0;
+uint8_t PCIData::m_auiExtEntry [ NUM_EXT_INTS ];
+volatile EDGE_EVENT PCIHandlerClass::m_aEvents [ CAPTURE_BUFFER_SIZE ];
+volatile uint8_t PCIHandlerClass::m_uiEventHead = 0;
+volatile uint8_t PCIHandlerClass::m_uiEventTail = 0;
+volatile uint16_t PCIHandlerClass::m_uiCaptureOverflows = 0;
 
 PCIData::PCIData ( void )
 {
 	m_uiPinCount = 0;
+	m_uiFilterCount = 0;
+	for ( uint8_t i = 0; i < NUM_PORTS; i++ )
+	{
+		m_PortInfo [ i ].uiRisingMask	= 0;
+		m_PortInfo [ i ].uiFallingMask	= 0;
+		m_PortInfo [ i ].uiCaptureMask	= 0;
+		m_PortInfo [ i ].uiFilterMask	= 0;
+		for ( uint8_t j = 0; j < PINS_PER_PORT; j++ )
+		{
+			m_PortInfo [ i ].auiEntry [ j ] = NO_PCI_ENTRY;
+		}
+	}
+	for ( uint8_t i = 0; i < NUM_EXT_INTS; i++ )
+	{
+		m_auiExtEntry [ i ] = NO_PCI_ENTRY;
+	}
+}
+
+bool PCIData::AddPin ( uint8_t uiDigitalPinNum, InterruptCallback pInterruptFn, uint8_t uiState, uint8_t uiMode, const PIN_FILTER* pFilter, uint16_t uiExpectedHz )
+{
+	return pInterruptFn != NULL && AddEntry ( uiDigitalPinNum, pInterruptFn, uiState, uiMode, pFilter, uiExpectedHz );
+}
+
+bool PCIData::AddCapturePin ( uint8_t uiDigitalPinNum, uint8_t uiState, uint8_t uiMode, const PIN_FILTER* pFilter, uint16_t uiExpectedHz )
+{
+	return AddEntry ( uiDigitalPinNum, NULL, uiState, uiMode, pFilter, uiExpectedHz );
 }
 
-bool PCIData::AddPin ( uint8_t uiDigitalPinNum, InterruptCallback pInterruptFn, uint8_t uiState, uint8_t uiMode )
+bool PCIData::AddEntry ( uint8_t uiDigitalPinNum, InterruptCallback pInterruptFn, uint8_t uiState, uint8_t uiMode, const PIN_FILTER* pFilter, uint16_t uiExpectedHz )
 {
 	bool bResult = false;
-	if ( !IsPinPresent ( uiDigitalPinNum ) && !IsFull() && ( uiState == FALLING || uiState == RISING || uiState == CHANGE ) )
+	bool bExpander = IsExpanderPin ( uiDigitalPinNum );
+
+	if ( !IsPinPresent ( uiDigitalPinNum ) && !IsFull() && ( bExpander || digitalPinToPCICR ( uiDigitalPinNum ) != 0 ) && IsValidState ( uiState )
+		 && ( pFilter == NULL || m_uiFilterCount < MAX_PIN_FILTERS ) )
 	{
+		uint8_t uiPort;
+		uint8_t uiBit;
+		int		iInt	= NOT_AN_INTERRUPT;
+
+		if ( bExpander )
+		{
+			uiPort	= NUM_PCI_PORTS + ( uiDigitalPinNum - FIRST_EXPANDER_PIN ) / PINS_PER_PORT;
+			uiBit	= ( uiDigitalPinNum - FIRST_EXPANDER_PIN ) % PINS_PER_PORT;
+		}
+		else
+		{
+			uiPort	= digitalPinToPort ( uiDigitalPinNum ) - FIRST_PCI_PORT;						// NB digitalPinToPort returns 2,3 or 4
+			uiBit	= digitalPinToPCMSKbit ( uiDigitalPinNum );									// same as bit in port on the Uno
+			iInt	= digitalPinToInterrupt ( uiDigitalPinNum );									// 0 or 1 for D2 and D3, NOT_AN_INTERRUPT otherwise
+			pinMode ( uiDigitalPinNum, uiMode );
+		}
+		bool	bExtInt	= uiExpectedHz >= HIGH_RATE_HZ && iInt >= 0 && iInt < NUM_EXT_INTS && m_auiExtEntry [ iInt ] == NO_PCI_ENTRY;
+
 		m_PinInfo [ m_uiPinCount ].uiPinNum		= uiDigitalPinNum;
 		m_PinInfo [ m_uiPinCount ].pCallBack	= pInterruptFn;
 		m_PinInfo [ m_uiPinCount ].uiMode		= uiState;
-		m_PinInfo [ m_uiPinCount ].uiLastState	= digitalRead ( uiDigitalPinNum );
-		m_PinInfo [ m_uiPinCount ].uiPinPort	= digitalPinToPort ( uiDigitalPinNum );				// NB digitalPinToPort returns 2,3 or 4
-		pinMode ( uiDigitalPinNum, uiMode );
+		m_PinInfo [ m_uiPinCount ].uiPinPort	= uiPort + FIRST_PCI_PORT;
+		m_PinInfo [ m_uiPinCount ].uiPinBit		= uiBit;
+		m_PinInfo [ m_uiPinCount ].uiFilter		= NO_PIN_FILTER;
+		m_PinInfo [ m_uiPinCount ].uiRoute		= bExpander ? ROUTE_EXPANDER : bExtInt ? ROUTE_INT0 + iInt : ROUTE_PCINT;
+		m_PinInfo [ m_uiPinCount ].bEnabled		= true;
+		if ( pFilter != NULL )
+		{
+			m_FilterInfo [ m_uiFilterCount ].Policy		= *pFilter;
+			m_FilterInfo [ m_uiFilterCount ].ulAverage	= 0;
+			m_FilterInfo [ m_uiFilterCount ].uiSamples	= 0;
+			m_FilterInfo [ m_uiFilterCount ].uiRejects	= 0;
+			m_FilterInfo [ m_uiFilterCount ].bSeenEdge	= false;
+			m_FilterInfo [ m_uiFilterCount ].ulLastChange = micros ();
+			m_PinInfo [ m_uiPinCount ].uiFilter = m_uiFilterCount++;
+		}
+
+		// interrupt routine must not see the pin in the masks before its entry is set, or miss the starting state of the pin
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		m_PortInfo [ uiPort ].auiEntry [ uiBit ] = m_uiPinCount;
+		if ( bExtInt )
+		{
+			m_auiExtEntry [ iInt ] = m_uiPinCount;
+		}
+		Attach ( m_uiPinCount );
 		m_uiPinCount++;
-		EnablePCI ( uiDigitalPinNum );
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
 		bResult = true;
 	}
 	return bResult;
 }
 
+// Entries are kept packed, the last entry is moved into the one freed and the tables that refer to it by index are updated. This is all
+// done with interrupts off so an interrupt routine never sees an entry part moved, pins on the same port carry on being monitored throughout
+bool PCIData::RemovePin ( uint8_t uiPin )
+{
+	bool bResult = false;
+	int8_t iEntry = FindPin ( uiPin );
+
+	if ( iEntry >= 0 )
+	{
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		PININFO* pPin = &m_PinInfo [ iEntry ];
+		if ( pPin->bEnabled )
+		{
+			Detach ( iEntry );
+		}
+		m_PortInfo [ pPin->uiPinPort - FIRST_PCI_PORT ].auiEntry [ pPin->uiPinBit ] = NO_PCI_ENTRY;
+		if ( pPin->uiRoute == ROUTE_INT0 || pPin->uiRoute == ROUTE_INT1 )
+		{
+			m_auiExtEntry [ pPin->uiRoute - ROUTE_INT0 ] = NO_PCI_ENTRY;
+		}
+		if ( pPin->uiFilter != NO_PIN_FILTER )
+		{
+			uint8_t uiLast = --m_uiFilterCount;
+			if ( pPin->uiFilter != uiLast )
+			{
+				m_FilterInfo [ pPin->uiFilter ] = m_FilterInfo [ uiLast ];
+				for ( uint8_t i = 0; i < m_uiPinCount; i++ )
+				{
+					if ( m_PinInfo [ i ].uiFilter == uiLast )
+					{
+						m_PinInfo [ i ].uiFilter = pPin->uiFilter;
+						break;
+					}
+				}
+			}
+		}
+		uint8_t uiLast = --m_uiPinCount;
+		if ( iEntry != uiLast )
+		{
+			*pPin = m_PinInfo [ uiLast ];
+			m_PortInfo [ pPin->uiPinPort - FIRST_PCI_PORT ].auiEntry [ pPin->uiPinBit ] = iEntry;
+			if ( pPin->uiRoute == ROUTE_INT0 || pPin->uiRoute == ROUTE_INT1 )
+			{
+				m_auiExtEntry [ pPin->uiRoute - ROUTE_INT0 ] = iEntry;
+			}
+		}
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
+		bResult = true;
+	}
+	return bResult;
+}
+
+bool PCIData::SetPinMode ( uint8_t uiPin, uint8_t uiState )
+{
+	bool bResult = false;
+	int8_t iEntry = FindPin ( uiPin );
+
+	if ( iEntry >= 0 && IsValidState ( uiState ) )
+	{
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		m_PinInfo [ iEntry ].uiMode = uiState;
+		if ( m_PinInfo [ iEntry ].bEnabled )
+		{
+			Attach ( iEntry );
+		}
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
+		bResult = true;
+	}
+	return bResult;
+}
+
+bool PCIData::EnablePin ( uint8_t uiPin, bool bEnable )
+{
+	bool bResult = false;
+	int8_t iEntry = FindPin ( uiPin );
+
+	if ( iEntry >= 0 )
+	{
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		if ( bEnable && !m_PinInfo [ iEntry ].bEnabled )
+		{
+			Attach ( iEntry );
+		}
+		else if ( !bEnable && m_PinInfo [ iEntry ].bEnabled )
+		{
+			Detach ( iEntry );
+		}
+		m_PinInfo [ iEntry ].bEnabled = bEnable;
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
+		bResult = true;
+	}
+	return bResult;
+}
+
+bool PCIData::IsPinEnabled ( uint8_t uiPin )
+{
+	int8_t iEntry = FindPin ( uiPin );
+
+	return iEntry >= 0 && m_PinInfo [ iEntry ].bEnabled;
+}
+
+// Sets the pin's bits in its port masks, or its INT sense, to match its entry. Call with interrupts off. A pin not yet enabled in PCMSK has
+// its last value seeded so its first interrupt isn't taken as a change. Pending flags are left alone as they may be for other pins.
+// Expander ports have every input's value stored on each scan so need no seeding
+void PCIData::Attach ( uint8_t uiEntry )
+{
+	PININFO*	pPin	= &m_PinInfo [ uiEntry ];
+	uint8_t		uiPort	= pPin->uiPinPort - FIRST_PCI_PORT;
+	uint8_t		uiMask	= 1 << pPin->uiPinBit;
+
+	if ( pPin->uiRoute == ROUTE_PCINT || pPin->uiRoute == ROUTE_EXPANDER )
+	{
+		PORTINFO* pPort = &m_PortInfo [ uiPort ];
+
+		pPort->uiRisingMask		= ( pPort->uiRisingMask & ~uiMask ) | ( pPin->uiMode != FALLING ? uiMask : 0 );
+		pPort->uiFallingMask	= ( pPort->uiFallingMask & ~uiMask ) | ( pPin->uiMode != RISING ? uiMask : 0 );
+		pPort->uiCaptureMask	= ( pPort->uiCaptureMask & ~uiMask ) | ( pPin->pCallBack == NULL ? uiMask : 0 );
+		pPort->uiFilterMask		= ( pPort->uiFilterMask & ~uiMask ) | ( pPin->uiFilter != NO_PIN_FILTER ? uiMask : 0 );
+		if ( pPin->uiRoute == ROUTE_PCINT && !( *digitalPinToPCMSK ( pPin->uiPinNum ) & uiMask ) )
+		{
+			m_PCintLastValues [ uiPort ] = ( m_PCintLastValues [ uiPort ] & ~uiMask ) | ( *portInputRegister ( pPin->uiPinPort ) & uiMask );
+			EnablePCI ( pPin->uiPinNum );
+		}
+	}
+	else
+	{
+		// not put in the port masks so pin change interrupts on the same port skip it, filtered pins need both edges to time the pulse
+		EnableExtInt ( pPin->uiRoute - ROUTE_INT0, pPin->uiFilter != NO_PIN_FILTER ? CHANGE : pPin->uiMode );
+	}
+}
+
+// Takes the pin out of its port masks, or turns off its INT, the rest of the port is unaffected. Call with interrupts off
+void PCIData::Detach ( uint8_t uiEntry )
+{
+	PININFO*	pPin	= &m_PinInfo [ uiEntry ];
+	uint8_t		uiMask	= 1 << pPin->uiPinBit;
+
+	if ( pPin->uiRoute == ROUTE_PCINT || pPin->uiRoute == ROUTE_EXPANDER )
+	{
+		PORTINFO* pPort = &m_PortInfo [ pPin->uiPinPort - FIRST_PCI_PORT ];
+
+		pPort->uiRisingMask		&= ~uiMask;
+		pPort->uiFallingMask	&= ~uiMask;
+		pPort->uiCaptureMask	&= ~uiMask;
+		pPort->uiFilterMask		&= ~uiMask;
+		if ( pPin->uiRoute == ROUTE_PCINT )
+		{
+			DisablePCI ( pPin->uiPinNum );
+		}
+	}
+	else
+	{
+		EIMSK &= ~( 1 << ( pPin->uiRoute - ROUTE_INT0 ) );
+	}
+}
+
+bool PCIData::IsValidState ( uint8_t uiState )
+{
+	return uiState == FALLING || uiState == RISING || uiState == CHANGE;
+}
+
+bool PCIData::IsExpanderPin ( uint8_t uiPin )
+{
+	return uiPin >= FIRST_EXPANDER_PIN && uiPin < EXPANDER_PIN ( MAX_EXPANDER_PORTS, 0 );
+}
+
 void PCIData::Dump ()
 {
 	Serial.print ( F ( "\nCount:" ) ); Serial.print ( m_uiPinCount );
@@ -126,8 +556,33 @@ void PCIData::Dump ()
 		Serial.print ( F ( "\nEntry:" ) ); Serial.print ( i );
 		Serial.print ( F ( " PinNum: " ) ); Serial.print ( m_PinInfo [ i ].uiPinNum );
 		Serial.print ( F ( " State: " ) ); Serial.print ( m_PinInfo [ i ].uiMode );
-		Serial.print ( F ( " LastState: " ) ); Serial.print ( m_PinInfo [ i ].uiLastState );
+		if ( !m_PinInfo [ i ].bEnabled )
+		{
+			Serial.print ( F ( " Disabled" ) );
+		}
 		Serial.print ( F ( " PinPort: " ) ); Serial.print ( m_PinInfo [ i ].uiPinPort );
+		Serial.print ( F ( " PinBit: " ) ); Serial.print ( m_PinInfo [ i ].uiPinBit );
+		Serial.print ( F ( " Route: " ) );
+		switch ( m_PinInfo [ i ].uiRoute )
+		{
+			case ROUTE_PCINT:		Serial.print ( F ( "PCINT" ) );		break;
+			case ROUTE_INT0:		Serial.print ( F ( "INT0" ) );		break;
+			case ROUTE_INT1:		Serial.print ( F ( "INT1" ) );		break;
+			case ROUTE_EXPANDER:	Serial.print ( F ( "Expander" ) );	break;
+		}
+		if ( m_PinInfo [ i ].uiFilter != NO_PIN_FILTER )
+		{
+			Serial.print ( F ( " Gap(us): " ) ); Serial.print ( GetFilterGap ( m_PinInfo [ i ].uiPinNum ) );
+			Serial.print ( F ( " Rejects: " ) ); Serial.print ( GetFilterRejects ( m_PinInfo [ i ].uiPinNum ) );
+		}
+	}
+	for ( uint8_t i = 0; i < NUM_PORTS; i++ )
+	{
+		Serial.print ( F ( "\nPort:" ) ); Serial.print ( i + FIRST_PCI_PORT );
+		Serial.print ( F ( " Rising: " ) ); Serial.print ( m_PortInfo [ i ].uiRisingMask, BIN );
+		Serial.print ( F ( " Falling: " ) ); Serial.print ( m_PortInfo [ i ].uiFallingMask, BIN );
+		Serial.print ( F ( " Capture: " ) ); Serial.print ( m_PortInfo [ i ].uiCaptureMask, BIN );
+		Serial.print ( F ( " LastValues: " ) ); Serial.print ( m_PCintLastValues [ i ], BIN );
 	}
 	Serial.println ();
 }
@@ -139,37 +594,125 @@ void PCIData::EnablePCI ( uint8_t uiPin )
 	*digitalPinToPCICR ( uiPin ) |= ( 1 << digitalPinToPCICRbit ( uiPin ) );
 }
 
+void PCIData::DisablePCI ( uint8_t uiPin )
+{
+	// the port's interrupt is turned off once none of its pins are monitored
+	*digitalPinToPCMSK ( uiPin ) &= ~( 1 << digitalPinToPCMSKbit ( uiPin ) );
+	if ( *digitalPinToPCMSK ( uiPin ) == 0 )
+	{
+		*digitalPinToPCICR ( uiPin ) &= ~( 1 << digitalPinToPCICRbit ( uiPin ) );
+	}
+}
+
+void PCIData::EnableExtInt ( uint8_t uiInt, uint8_t uiSense )
+{
+	// each INT has 2 sense bits in EICRA, clear any flag set by an edge before the sense was chosen so it doesn't fire straight away
+	EICRA = ( EICRA & ~( 3 << ( uiInt * 2 ) ) ) | ( uiSense << ( uiInt * 2 ) );
+	EIFR = 1 << uiInt;
+	EIMSK |= 1 << uiInt;
+}
+
+ePinRoute PCIData::GetRoute ( uint8_t uiPin )
+{
+	ePinRoute eResult = ROUTE_NONE;
+	int8_t iEntry = FindPin ( uiPin );
+
+	if ( iEntry >= 0 )
+	{
+		eResult = ( ePinRoute )m_PinInfo [ iEntry ].uiRoute;
+	}
+	return eResult;
+}
+
 InterruptCallback PCIData::GetCallback ( uint8_t uiPin )
 {
 	InterruptCallback pResult = 0;
+	int8_t iEntry = FindPin ( uiPin );
 
-	for ( uint8_t i = 0; i < m_uiPinCount; i++ )
+	if ( iEntry >= 0 )
 	{
-		if ( m_PinInfo [ i ].uiPinNum == uiPin )
+		pResult = m_PinInfo [ iEntry ].pCallBack;
+	}
+	return pResult;
+}
+
+// The policy is only written by AddPin, from loop, so it can be copied without stopping interrupts
+bool PCIData::GetPinFilter ( uint8_t uiPin, PIN_FILTER* pFilter )
+{
+	bool bResult = false;
+	int8_t iEntry = FindPin ( uiPin );
+
+	if ( iEntry >= 0 && m_PinInfo [ iEntry ].uiFilter != NO_PIN_FILTER )
+	{
+		*pFilter = m_FilterInfo [ m_PinInfo [ iEntry ].uiFilter ].Policy;
+		bResult = true;
+	}
+	return bResult;
+}
+
+uint32_t PCIData::GetFilterGap ( uint8_t uiPin )
+{
+	uint32_t ulResult = 0;
+	int8_t iEntry = FindPin ( uiPin );
+
+	if ( iEntry >= 0 && m_PinInfo [ iEntry ].uiFilter != NO_PIN_FILTER )
+	{
+		FILTERINFO* pFilter = &m_FilterInfo [ m_PinInfo [ iEntry ].uiFilter ];
+
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		ulResult = pFilter->Policy.ulMinGapus;
+		if ( pFilter->Policy.bAdaptive && pFilter->uiSamples >= ADAPTIVE_SEED_SAMPLES && ( pFilter->ulAverage >> 2 ) > ulResult )
 		{
-			pResult = m_PinInfo [ i ].pCallBack;
-			break;
+			ulResult = pFilter->ulAverage >> 2;
 		}
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
 	}
-	return pResult;
+	return ulResult;
 }
 
-bool PCIData::IsFull ()
+uint16_t PCIData::GetFilterRejects ( uint8_t uiPin )
 {
-	return !( m_uiPinCount < MAX_PCI_PINS );
+	uint16_t uiResult = 0;
+	int8_t iEntry = FindPin ( uiPin );
+
+	if ( iEntry >= 0 && m_PinInfo [ iEntry ].uiFilter != NO_PIN_FILTER )
+	{
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		uiResult = m_FilterInfo [ m_PinInfo [ iEntry ].uiFilter ].uiRejects;
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
+	}
+	return uiResult;
 }
 
-bool PCIData::IsPinPresent ( uint8_t uiPin )
+int8_t PCIData::FindPin ( uint8_t uiPin )
 {
-	bool bResult = false;
+	int8_t iResult = -1;
 
 	for ( uint8_t i = 0; i < m_uiPinCount; i++ )
 	{
 		if ( m_PinInfo [ i ].uiPinNum == uiPin )
 		{
-			bResult = true;
+			iResult = i;
 			break;
 		}
 	}
-	return bResult;;
+	return iResult;
+}
+
+bool PCIData::IsFull ()
+{
+	return !( m_uiPinCount < MAX_PCI_PINS );
+}
+
+bool PCIData::IsPinPresent ( uint8_t uiPin )
+{
+	return FindPin ( uiPin ) >= 0;
 }
@@ -7,25 +7,96 @@
 //  This code enables users to sepcify a pin to be monitored using the mcu PCI functionality
 //	A pin can be configured along with a requested callback routine. The pin must be identified using an Arduino digital pin number
 //
+//	AddPin builds a table for each port giving, for each bit, the entry to call back and masks of the bits wanting rising and falling edges
+//	(a CHANGE pin is in both). The interrupt routine works out which wanted edges have occurred from the port register with a few logical
+//	operations and only visits the bits that fired, so its cost doesn't depend on how many pins are being monitored
+//
+//	Pins added with AddCapturePin have no callback, instead each wanted edge is recorded with the pin, whether it rose or fell and the time in micros
+//	in a ring buffer. The interrupt routine is the only writer and the sketch the only reader so no locking is needed, the sketch reads events in
+//	batches with ReadEvents. This keeps the interrupt short so edges are far less likely to be missed, gives the exact time between edges and, as
+//	long as the buffer is read often enough, every edge is counted. Events that arrive when the buffer is full are counted as overflows
+//
+//	Either kind of pin can be given a PIN_FILTER to reject noise before its callback is run or its event recorded. An edge is ignored if the
+//	pin was at its previous level for less than the minimum pulse width (contact bounce, glitches) or if it comes sooner than the minimum gap
+//	after the last edge accepted. In adaptive mode the gap is also raised to a quarter of the average interval seen between accepted edges,
+//	so a sensor whose rate is known only roughly can be filtered without tuning. The average is only used once ADAPTIVE_SEED_SAMPLES intervals
+//	have been learnt. An interval ADAPTIVE_IDLE_MULTIPLE times longer than the average, eg the machine stopping, is a pause and the average is
+//	learnt again, as it is if one that much shorter shows the intervals learnt so far included a pause. Filter state is kept for MAX_PIN_FILTERS
+//	pins
+//
+//	A pin can be given the rate in edges per second it is expected to signal at. If that is at least HIGH_RATE_HZ and the pin is D2 or D3 it is
+//	routed to its own external interrupt (INT0 or INT1) instead, the hardware selects the edge so the interrupt runs only for wanted edges and
+//	goes straight to the one pin with no port scan. Other pins, or when the INT is already taken, use pin change interrupts as before. Filters
+//	and capture work the same on either route, a filtered pin's INT is set to interrupt on every change so its pulse width can still be timed.
+//	GetRoute and Dump show which route a pin got and TheProfiler times the INT0 and INT1 vectors separately from the PCINT ones
+//
+//	Pins can be changed while running. RemovePin frees a pin's entry and filter, SetPinMode changes the edge it signals on and DisablePin /
+//	EnablePin stop and restart it without losing its settings. The masks are updated with interrupts off and a port's pin change interrupt is
+//	turned off when it has no pins left, other pins on the port carry on being monitored without missing edges
+//
+//	Inputs read from shift registers by TheInputExpander are handled as extra ports after the 3 real ones, given virtual pin numbers from
+//	FIRST_EXPANDER_PIN. The expander passes each port's byte to CheckPortPins when it scans, so these pins are added, filtered, captured and
+//	called back in exactly the same way as real pins, but only as often as the scan runs
+//
 //	NB This is written and tested to work on the Arduino Uno
 //
 #ifndef _PCIHANDLER_h
 #define _PCIHANDLER_h
 
 #if defined(ARDUINO) && ARDUINO >= 100
-	#include "arduino.h"
+	#include "Arduino.h"
 #else
 	#include "WProgram.h"
 #endif
 #define		NUM_PCI_PORTS		3										// number of ports on Atmel chip on arduino Uno board that can generate a PCI
-#define		MAX_PCI_PINS		8										// max number of PCI pins allowed to be monitored
+#define		MAX_PCI_PINS		( 20 + MAX_EXPANDER_PORTS * 4 )			// max number of pins allowed to be monitored, every pin on the Uno and half the expander inputs
+#define		FIRST_PCI_PORT		2										// digitalPinToPort value for port B, ports B, C & D are indexed 0 - 2
+#define		MAX_EXPANDER_PORTS	2										// virtual ports fed by TheInputExpander, one per 74HC165, indexed from NUM_PCI_PORTS
+#define		NUM_PORTS			( NUM_PCI_PORTS + MAX_EXPANDER_PORTS )
+#define		FIRST_EXPANDER_PIN	64										// pin number of first expander input, well clear of the Uno's real pins
+#define		EXPANDER_PIN( uiPort, uiInput )	( FIRST_EXPANDER_PIN + ( uiPort ) * PINS_PER_PORT + ( uiInput ) )	// input 0 - 7 (A - H) of expander chip 0 - n
+#define		PINS_PER_PORT		8
+#define		NO_PCI_ENTRY		0xFF
+#define		CAPTURE_BUFFER_SIZE	32										// edge events held, must be a power of 2
+#define		MAX_PIN_FILTERS		8										// max number of pins that can have a filter, a drip sensor for each of 6 motors and the machine pins
+#define		NO_PIN_FILTER		0xFF
+#define		ADAPTIVE_SEED_SAMPLES	4									// intervals seen before an adaptive filter's average is used
+#define		ADAPTIVE_IDLE_MULTIPLE	8									// an interval this many times the average is a pause, the average is learnt again
+#define		NUM_EXT_INTS		2										// INT0 on D2, INT1 on D3
+#define		HIGH_RATE_HZ		100										// pins expected to signal at least this often get an external interrupt if they can
 typedef void ( *InterruptCallback )( void );
 
+typedef struct
+{
+	uint32_t			ulMinPulseus;									// pin must have been at its previous level this long, 0 for no check
+	uint32_t			ulMinGapus;										// ignore edges closer than this to the last one accepted, 0 for no check
+	bool				bAdaptive;										// also ignore edges closer than a quarter of the average interval
+} PIN_FILTER;
+
+typedef struct
+{
+	uint8_t				uiPin;											// Arduino digital pin number
+	uint8_t				uiEdge;											// RISING or FALLING
+	uint32_t			ulMicros;										// micros () when the interrupt ran
+} EDGE_EVENT;
+
+enum ePinRoute { ROUTE_NONE, ROUTE_PCINT, ROUTE_INT0, ROUTE_INT1, ROUTE_EXPANDER };
+
 class PCIData
 {
 public:
 						PCIData ( void );
-	bool				AddPin ( uint8_t uiDigitalPinNum, InterruptCallback pInterruptFn, uint8_t uiState, uint8_t uiMode = INPUT_PULLUP ); // add pin to be monitored, function to be called if the signal matches mode (RISING, FALLING or  CHANGE), defaults to INPUT_PULLUP
+	bool				AddPin ( uint8_t uiDigitalPinNum, InterruptCallback pInterruptFn, uint8_t uiState, uint8_t uiMode = INPUT_PULLUP, const PIN_FILTER* pFilter = NULL, uint16_t uiExpectedHz = 0 ); // add pin to be monitored, function to be called if the signal matches mode (RISING, FALLING or  CHANGE), defaults to INPUT_PULLUP, optionally filtered, uiExpectedHz is a rate hint
+	bool				AddCapturePin ( uint8_t uiDigitalPinNum, uint8_t uiState, uint8_t uiMode = INPUT_PULLUP, const PIN_FILTER* pFilter = NULL, uint16_t uiExpectedHz = 0 );							// as AddPin but edges matching uiState are recorded for ReadEvents
+	bool				RemovePin ( uint8_t uiPin );										// stop monitoring pin and free its entry and filter
+	bool				SetPinMode ( uint8_t uiPin, uint8_t uiState );						// change the edge (RISING, FALLING or CHANGE) a monitored pin signals on
+	bool				EnablePin ( uint8_t uiPin, bool bEnable = true );					// disabled pins keep their entry but don't interrupt
+	bool				DisablePin ( uint8_t uiPin ) { return EnablePin ( uiPin, false ); }
+	bool				IsPinEnabled ( uint8_t uiPin );
+	ePinRoute			GetRoute ( uint8_t uiPin );											// interrupt the pin was given, ROUTE_NONE if not monitored
+	bool				GetPinFilter ( uint8_t uiPin, PIN_FILTER* pFilter );					// copies the policy pin was added with, false if not filtered
+	uint32_t			GetFilterGap ( uint8_t uiPin );											// gap currently applied to pin in us, including any learnt, 0 if not filtered
+	uint16_t			GetFilterRejects ( uint8_t uiPin );										// edges ignored by pin's filter
 	InterruptCallback	GetCallback ( uint8_t uiPin );
 	void				Dump ();
 
@@ -33,26 +104,70 @@ protected:
 	bool				IsFull ();
 	bool				IsPinPresent ( uint8_t uiPin );
 	void				EnablePCI ( uint8_t uiPin );
+	void				DisablePCI ( uint8_t uiPin );
+	void				EnableExtInt ( uint8_t uiInt, uint8_t uiSense );				// uiSense RISING, FALLING or CHANGE, these match the EICRA encoding
+	bool				AddEntry ( uint8_t uiDigitalPinNum, InterruptCallback pInterruptFn, uint8_t uiState, uint8_t uiMode, const PIN_FILTER* pFilter, uint16_t uiExpectedHz );
+	void				Attach ( uint8_t uiEntry );										// put entry's pin in masks / enable its interrupt, interrupts must be off
+	void				Detach ( uint8_t uiEntry );										// take entry's pin out of masks / disable its interrupt, interrupts must be off
+	bool				IsValidState ( uint8_t uiState );
+	bool				IsExpanderPin ( uint8_t uiPin );
+	int8_t				FindPin ( uint8_t uiPin );										// m_PinInfo index, -1 if not present
 
 	static struct PININFO
 	{
 		uint8_t				uiPinNum;									// Pin being monitored
 		uint8_t				uiPinPort;									// mcu Port that pin belongs to
+		uint8_t				uiPinBit;									// bit number of pin within port
 		uint8_t				uiMode;										// mode that (RISING, FALLING or CHANGE) if true invokes callback
-		uint8_t				uiLastState;								// HIGH or LOW
-		InterruptCallback	pCallBack;									// function to call when pin signals
+		uint8_t				uiFilter;									// m_FilterInfo index or NO_PIN_FILTER
+		uint8_t				uiRoute;									// ePinRoute
+		bool				bEnabled;
+		InterruptCallback	pCallBack;									// function to call when pin signals, NULL for capture pins
 	} m_PinInfo [ MAX_PCI_PINS ];
 	static uint8_t	m_uiPinCount;										// Count of pins being monitored
+
+	static struct PORTINFO
+	{
+		uint8_t				uiRisingMask;								// bits to call back on when they go high
+		uint8_t				uiFallingMask;								// bits to call back on when they go low
+		uint8_t				uiCaptureMask;								// bits to record in the capture buffer rather than call back
+		uint8_t				uiFilterMask;								// bits with a filter, these see every change not just wanted edges
+		uint8_t				auiEntry [ PINS_PER_PORT ];					// m_PinInfo index for each bit, NO_PCI_ENTRY if not monitored
+	} m_PortInfo [ NUM_PORTS ];
+	volatile static uint8_t m_PCintLastValues [ NUM_PORTS ];		// holds the prior PCINT pin values, used to determine when one changes.
+	static uint8_t	m_auiExtEntry [ NUM_EXT_INTS ];						// m_PinInfo index for each external interrupt, NO_PCI_ENTRY if not used
+
+	static struct FILTERINFO
+	{
+		PIN_FILTER			Policy;
+		uint32_t			ulLastChange;								// micros of last change in either direction
+		uint32_t			ulLastAccepted;								// micros of last edge passed through
+		uint32_t			ulAverage;									// average interval between accepted edges, adaptive mode only
+		uint8_t				uiSamples;									// intervals in ulAverage, up to ADAPTIVE_SEED_SAMPLES
+		uint16_t			uiRejects;
+		bool				bSeenEdge;									// ulLastAccepted is valid
+	} m_FilterInfo [ MAX_PIN_FILTERS ];
+	static uint8_t	m_uiFilterCount;
 };
 
 class PCIHandlerClass : public PCIData
 {
 public:
 							PCIHandlerClass ();
-			 static void	CheckPortPins ( uint8_t uiPortIdGeneratingInterrupt );		// Called when a pin on the provided port signals, checks if one that pin is of interest
-			 static	void	InvokeCallback ( uint8_t uiChangedPins, uint8_t uiPortIdGeneratingInterrupt );
+			 static void	CheckPortPins ( uint8_t uiPort, uint8_t uiCurrentPCIReg );	// Called with port index and its sampled input register when a pin on the port signals
+			 static void	CheckExtPin ( uint8_t uiInt, uint8_t uiCurrentPCIReg );	// Called with INT number and the sampled input register of its port when it signals
+			 static	void	InvokeCallback ( uint8_t uiFiredPins, uint8_t uiPort );		// calls back each pin whose bit is set in uiFiredPins
+			 static void	Capture ( uint8_t uiFiredPins, uint8_t uiPort, uint8_t uiCurrentPCIReg );	// records an event for each pin whose bit is set in uiFiredPins
+			 static void	SeedPort ( uint8_t uiPort, uint8_t uiCurrentPCIReg );		// sets a port's prior values without looking for changes, for the expander's first scan
+			 static uint8_t	Filter ( uint8_t uiFiredPins, uint8_t uiChangedPins, uint8_t uiPort );	// returns uiFiredPins less edges rejected by filters
+					uint8_t	ReadEvents ( EDGE_EVENT* pEvents, uint8_t uiMaxEvents );	// copies out and removes up to uiMaxEvents oldest events, returns number copied
+					uint8_t	GetEventCount ( void );										// events waiting to be read
+					uint16_t GetCaptureOverflows ( void );								// events lost because buffer was full
 protected:
-	volatile static uint8_t m_PCintLastValues [ NUM_PCI_PORTS ];		// holds the prior PCINT pin values, used to determine when one changes.
+	volatile static EDGE_EVENT m_aEvents [ CAPTURE_BUFFER_SIZE ];
+	volatile static uint8_t	m_uiEventHead;										// next free slot, written by interrupt routine only
+	volatile static uint8_t	m_uiEventTail;										// oldest event, written by ReadEvents only
+	volatile static uint16_t m_uiCaptureOverflows;
 };
 
 extern PCIHandlerClass PCIHandler;
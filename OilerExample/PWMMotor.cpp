@@ -0,0 +1,196 @@
+//
+// PWMMotor.cpp
+//
+// (c) Mark Naylor June 2021
+//
+//	Implementation of PWM speed controlled DC motor as derivative of Motor, see PWMMotor.h
+//
+
+#include "PWMMotor.h"
+#include "Timer.h"
+#include "Profiler.h"
+
+PWMMotorClass::PWMMotorClass ( uint8_t uiPin, uint32_t ulSpeed, uint16_t uiSoftStartms ) : MotorClass ( 0 )
+{
+	m_uiPin			= uiPin;
+	m_puiCompare	= NULL;
+	m_uiConnect		= 0;
+	m_uiDuty		= 0;
+	m_hRamp			= INVALID_TIMER;
+	if ( m_uiPin == 6 )
+	{
+		m_puiCompare	= &OCR0A;
+		m_uiConnect		= ( 1 << COM0A1 );
+	}
+	else if ( m_uiPin == 5 )
+	{
+		m_puiCompare	= &OCR0B;
+		m_uiConnect		= ( 1 << COM0B1 );
+	}
+	digitalWrite ( m_uiPin, LOW );
+	pinMode ( m_uiPin, OUTPUT );
+	SetSoftStart ( uiSoftStartms );
+	SetSpeed ( ulSpeed );
+}
+
+bool PWMMotorClass::On ( void )
+{
+	bool bResult = false;
+
+	if ( m_puiCompare != NULL )
+	{
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		if ( m_eState == STOPPED )
+		{
+			WriteDuty ( m_uiTargetDuty < PWM_START_DUTY || m_uiRampStep == 0 ? m_uiTargetDuty : PWM_START_DUTY );
+			StartRamp ();
+			MotorClass::On ();
+		}
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
+		bResult = true;
+	}
+	return bResult;
+}
+
+bool PWMMotorClass::Off ( void )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	if ( m_hRamp != INVALID_TIMER )
+	{
+		TheTimer.RemoveTimer ( m_hRamp );
+		m_hRamp = INVALID_TIMER;
+	}
+	WriteDuty ( 0 );
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+	MotorClass::Off ();
+	return true;
+}
+
+bool PWMMotorClass::SetSpeed ( uint32_t ulSpeed )
+{
+	if ( ulSpeed > PWM_MAX_SPEED )
+	{
+		ulSpeed = PWM_MAX_SPEED;
+	}
+	m_ulSpeed = ulSpeed;
+
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	m_uiTargetDuty = ( ulSpeed * PWM_MAX_DUTY + PWM_MAX_SPEED / 2 ) / PWM_MAX_SPEED;
+	if ( m_eState == RUNNING )
+	{
+		if ( m_uiTargetDuty < m_uiDuty )
+		{
+			WriteDuty ( m_uiTargetDuty );
+		}
+		StartRamp ();
+	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+	return true;
+}
+
+// duty step for each tick so a ramp from PWM_START_DUTY to full takes the soft start time
+void PWMMotorClass::SetSoftStart ( uint16_t uiSoftStartms )
+{
+	uint16_t uiTicks = uiSoftStartms / PWM_RAMP_TICK_MS;
+
+	m_uiSoftStartms = uiSoftStartms;
+	if ( uiTicks == 0 )
+	{
+		m_uiRampStep = 0;
+	}
+	else
+	{
+		uint16_t uiStep = ( PWM_MAX_DUTY - PWM_START_DUTY + uiTicks - 1 ) / uiTicks;
+		m_uiRampStep = uiStep > 0 ? uiStep : 1;
+	}
+}
+
+uint8_t PWMMotorClass::GetDuty ( void )
+{
+	return m_uiDuty;
+}
+
+void PWMMotorClass::SetDirection ( eDirection /* Direction */ )
+{
+	// not used, direction is set by wiring
+}
+
+MotorClass::eState PWMMotorClass::GetMotorState ( void )
+{
+	return MotorClass::GetMotorState ();
+}
+
+bool PWMMotorClass::IsPWMPin ( uint8_t uiPin )
+{
+	return uiPin == 5 || uiPin == 6;
+}
+
+void PWMMotorClass::RampCallback ( void* pContext )
+{
+	( ( PWMMotorClass* ) pContext )->Ramp ();
+}
+
+// Adds the ramp's timer if the duty is below target, or jumps straight there with no soft start
+void PWMMotorClass::StartRamp ( void )
+{
+	if ( m_uiDuty < m_uiTargetDuty )
+	{
+		if ( m_uiRampStep == 0 )
+		{
+			WriteDuty ( m_uiTargetDuty );
+		}
+		else if ( m_hRamp == INVALID_TIMER )
+		{
+			m_hRamp = TheTimer.AddTimer ( RampCallback, this, TheTimer.MicrosToTicks ( PWM_RAMP_TICK_MS * 1000UL ) );
+			if ( m_hRamp == INVALID_TIMER )
+			{
+				// no timer free, better a hard start than not reaching speed
+				WriteDuty ( m_uiTargetDuty );
+			}
+		}
+	}
+}
+
+// Runs from TheTimer's interrupt, removes its own timer once at speed
+void PWMMotorClass::Ramp ( void )
+{
+	uint16_t uiDuty = m_uiDuty + m_uiRampStep;
+
+	if ( uiDuty >= m_uiTargetDuty )
+	{
+		uiDuty = m_uiTargetDuty;
+		TheTimer.RemoveTimer ( m_hRamp );
+		m_hRamp = INVALID_TIMER;
+	}
+	WriteDuty ( uiDuty );
+}
+
+// In fast PWM a compare value of 0 still gives a pulse each cycle, so 0 disconnects the pin and leaves it low
+void PWMMotorClass::WriteDuty ( uint8_t uiDuty )
+{
+	if ( m_puiCompare != NULL )
+	{
+		*m_puiCompare = uiDuty;
+		if ( uiDuty == 0 )
+		{
+			TCCR0A &= ~m_uiConnect;
+		}
+		else
+		{
+			TCCR0A |= m_uiConnect;
+		}
+	}
+	m_uiDuty = uiDuty;
+}
@@ -0,0 +1,65 @@
+//
+// PWMMotor.h
+//
+// (c) Mark Naylor June 2021
+//
+//	Defines a DC pump motor whose speed, and so its flow, is set by PWM as a derivative of Motor. The pin must be driven through a MOSFET or
+//	motor driver, not a relay. SetSpeed takes a percentage of full speed and can be changed while running, so flow can be turned up to finish
+//	oiling sooner or down to save oil.
+//
+//	The PWM is made by Timer0's compare outputs, which the Arduino core already runs in fast PWM mode at about 1kHz for analogWrite, so the
+//	motor must be on D6 (OC0A) or D5 (OC0B). Timer1 and Timer2 are used by TheStepTimer and TheTimer so their PWM pins can't be used. Duty
+//	is written straight to the compare register, a duty of 0 disconnects the pin so the motor is fully off rather than given a short pulse
+//	each cycle.
+//
+//	To avoid the inrush current of starting a motor at full voltage, On starts at PWM_START_DUTY and raises the duty in steps from a TheTimer
+//	callback every PWM_RAMP_TICK_MS until it reaches the set speed after the soft start time. Speeding up while running is ramped in the same
+//	way, slowing down and Off take effect at once.
+//
+#ifndef _PWMMOTOR_h
+#define _PWMMOTOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include <Arduino.h>
+#else
+	#include "WProgram.h"
+#endif
+#include "Motor.h"
+
+#define		PWM_MAX_SPEED			100									// SetSpeed is a percentage of full speed
+#define		PWM_MAX_DUTY			255
+#define		PWM_START_DUTY			40									// duty a soft start begins at, enough for most pumps to turn
+#define		PWM_SOFT_START_MS		500									// default time taken to get from PWM_START_DUTY to full speed
+#define		PWM_RAMP_TICK_MS		10									// time between duty steps during a soft start
+
+class PWMMotorClass final : public MotorClass
+{
+public:
+						PWMMotorClass ( uint8_t uiPin, uint32_t ulSpeed, uint16_t uiSoftStartms = PWM_SOFT_START_MS );	// ulSpeed percent, pin must be 5 or 6
+	bool				On ( void );
+	bool				Off ( void );
+	bool				SetSpeed ( uint32_t ulSpeed );								// percent of full speed, applied at once if running, ramped if it goes up
+	void				SetSoftStart ( uint16_t uiSoftStartms );					// 0 for none, used from the next ramp
+	uint8_t				GetDuty ( void );											// duty being output now, 0 - PWM_MAX_DUTY
+	void				SetDirection ( eDirection Direction );						// Does nothing for this type of motor
+	MotorClass::eState	GetMotorState ( void );
+	static bool			IsPWMPin ( uint8_t uiPin );
+	static void			RampCallback ( void* pContext );							// TheTimer callback while ramping up
+
+protected:
+	void				Ramp ( void );												// one duty step towards the target, called with interrupts off
+	void				StartRamp ( void );											// called with interrupts off
+	void				WriteDuty ( uint8_t uiDuty );								// called with interrupts off
+
+	uint8_t				m_uiPin;
+	volatile uint8_t*	m_puiCompare;												// OCR0A or OCR0B, NULL if pin has no PWM
+	uint8_t				m_uiConnect;												// COM0x1 bit in TCCR0A, non inverting PWM when set
+	uint8_t				m_uiTargetDuty;												// duty for m_ulSpeed
+	volatile uint8_t	m_uiDuty;													// duty being output
+	uint8_t				m_uiRampStep;												// duty added each ramp tick
+	uint16_t			m_uiSoftStartms;
+	TimerHandle			m_hRamp;													// INVALID_TIMER when not ramping
+};
+
+#endif
+
@@ -0,0 +1,137 @@
+//
+//  Profiler.cpp
+//
+// (c) Mark Naylor June 2021
+//
+//	Implements interrupt routine and interrupt free section timing, see Profiler.h
+//
+
+#include "Profiler.h"
+
+#ifdef ISR_PROFILING
+
+#include "Timer.h"
+
+ProfilerClass::ProfilerClass ( void )
+{
+	Reset ();
+}
+
+void ProfilerClass::Begin ( void )
+{
+	// using TheStepTimer as a clock keeps Timer1 counting when no motor is stepping
+	TheStepTimer.GetTicks ();
+}
+
+// Called with interrupts disabled
+void ProfilerClass::Add ( PROFILE_STATS* pStats, uint16_t uiTicks )
+{
+	uint8_t		uiBucket	= 0;
+	uint16_t	uiLimit		= PROFILE_FIRST_BUCKET;
+
+	if ( pStats->ulTotal > 0x7FFFFFFFUL )
+	{
+		pStats->ulTotal >>= 1;
+		pStats->ulCount >>= 1;
+	}
+	pStats->ulTotal += uiTicks;
+	pStats->ulCount++;
+	if ( uiTicks < pStats->uiMin )
+	{
+		pStats->uiMin = uiTicks;
+	}
+	if ( uiTicks > pStats->uiMax )
+	{
+		pStats->uiMax = uiTicks;
+	}
+	while ( uiBucket < PROFILE_BUCKETS - 1 && uiTicks >= uiLimit )
+	{
+		uiLimit <<= 1;
+		uiBucket++;
+	}
+	if ( pStats->auiBuckets [ uiBucket ] != 0xFFFF )
+	{
+		pStats->auiBuckets [ uiBucket ]++;
+	}
+}
+
+void ProfilerClass::Record ( uint8_t uiVector, uint16_t uiTicks )
+{
+	if ( uiVector < NUM_PROFILED_VECTORS )
+	{
+		Add ( &m_aVectors [ uiVector ], uiTicks );
+	}
+}
+
+void ProfilerClass::RecordCritical ( uint16_t uiTicks )
+{
+	Add ( &m_Critical, uiTicks );
+}
+
+void ProfilerClass::Reset ( void )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	for ( uint8_t i = 0; i <= NUM_PROFILED_VECTORS; i++ )
+	{
+		PROFILE_STATS* pStats = i < NUM_PROFILED_VECTORS ? &m_aVectors [ i ] : &m_Critical;
+
+		pStats->ulCount	= 0;
+		pStats->ulTotal	= 0;
+		pStats->uiMin	= 0xFFFF;
+		pStats->uiMax	= 0;
+		for ( uint8_t j = 0; j < PROFILE_BUCKETS; j++ )
+		{
+			pStats->auiBuckets [ j ] = 0;
+		}
+	}
+	SREG = uiSREG;
+}
+
+// Takes a copy with interrupts off so the figures printed are consistent, times are printed in microseconds
+void ProfilerClass::DumpStats ( const __FlashStringHelper* pName, PROFILE_STATS* pStats )
+{
+	PROFILE_STATS Stats;
+
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	Stats = *pStats;
+	SREG = uiSREG;
+
+	Serial.print ( pName );
+	Serial.print ( F ( " Count: " ) ); Serial.print ( Stats.ulCount );
+	if ( Stats.ulCount > 0 )
+	{
+		Serial.print ( F ( " Min: " ) ); Serial.print ( Stats.uiMin / 2.0 );
+		Serial.print ( F ( " Avg: " ) ); Serial.print ( Stats.ulTotal / 2.0 / Stats.ulCount );
+		Serial.print ( F ( " Max: " ) ); Serial.print ( Stats.uiMax / 2.0 );
+		Serial.print ( F ( " Hist:" ) );
+		for ( uint8_t j = 0; j < PROFILE_BUCKETS; j++ )
+		{
+			Serial.print ( ' ' ); Serial.print ( Stats.auiBuckets [ j ] );
+		}
+	}
+	Serial.println ();
+}
+
+void ProfilerClass::Dump ( void )
+{
+	Serial.print ( F ( "\nTimes in us, histogram buckets <4 <8 <16 <32 <64 <128 <256 >=256\n" ) );
+	DumpStats ( F ( "TIMER2_COMPA" ), &m_aVectors [ PROFILE_TIMER2_COMPA ] );
+	DumpStats ( F ( "TIMER2_OVF  " ), &m_aVectors [ PROFILE_TIMER2_OVF ] );
+	DumpStats ( F ( "TIMER1_COMPA" ), &m_aVectors [ PROFILE_TIMER1_COMPA ] );
+	DumpStats ( F ( "TIMER1_OVF  " ), &m_aVectors [ PROFILE_TIMER1_OVF ] );
+	DumpStats ( F ( "TIMER1_COMPB" ), &m_aVectors [ PROFILE_TIMER1_COMPB ] );
+	DumpStats ( F ( "PCINT0      " ), &m_aVectors [ PROFILE_PCINT0 ] );
+	DumpStats ( F ( "PCINT1      " ), &m_aVectors [ PROFILE_PCINT1 ] );
+	DumpStats ( F ( "PCINT2      " ), &m_aVectors [ PROFILE_PCINT2 ] );
+	DumpStats ( F ( "INT0        " ), &m_aVectors [ PROFILE_INT0 ] );
+	DumpStats ( F ( "INT1        " ), &m_aVectors [ PROFILE_INT1 ] );
+	DumpStats ( F ( "Expander    " ), &m_aVectors [ PROFILE_EXPANDER ] );
+	DumpStats ( F ( "Step engine " ), &m_aVectors [ PROFILE_STEP_ENGINE ] );
+	DumpStats ( F ( "Ints off    " ), &m_Critical );
+}
+
+ProfilerClass TheProfiler;
+
+#endif
@@ -0,0 +1,82 @@
+//
+//  Profiler.h
+//
+// (c) Mark Naylor June 2021
+//
+//	This class measures how long each interrupt routine takes, including the callbacks it makes, and the longest time interrupts are held off by
+//	code running outside of an interrupt. Times are taken from the Timer1 counter which TheProfiler keeps free running at 0.5us a tick, so each
+//	tick is 8 cpu cycles. For each vector it keeps the count, min, average and max along with a histogram of durations in doubling buckets.
+//
+//	Interrupt routines are bracketed with PROFILE_ISR_START and PROFILE_ISR_END, interrupt free sections with PROFILE_CRITICAL_START and
+//	PROFILE_CRITICAL_END. The section's time is taken by PROFILE_CRITICAL_END but only recorded by PROFILE_CRITICAL_RECORD after SREG is put
+//	back, so the recording doesn't lengthen the time interrupts are held off. Profiling is off as supplied, uncomment ISR_PROFILING to build
+//	it in, otherwise the macros expand to nothing.
+//
+//	NB this takes over Timer1 in the same way as TheStepTimer does, so the sketch must call TheProfiler.Begin in setup
+//
+#ifndef _PROFILER_h
+#define _PROFILER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include <Arduino.h>
+#else
+	#include "WProgram.h"
+#endif
+
+//#define		ISR_PROFILING									// uncomment to build in profiling
+
+#ifdef ISR_PROFILING
+
+#define		PROFILE_BUCKETS			8							// bucket n counts durations under 4us << n, the last bucket counts the rest
+#define		PROFILE_FIRST_BUCKET	8							// ticks, 4us
+
+enum eProfiledVector { PROFILE_TIMER2_COMPA, PROFILE_TIMER2_OVF, PROFILE_TIMER1_COMPA, PROFILE_TIMER1_OVF, PROFILE_TIMER1_COMPB, PROFILE_PCINT0, PROFILE_PCINT1, PROFILE_PCINT2, PROFILE_INT0, PROFILE_INT1, PROFILE_EXPANDER, PROFILE_STEP_ENGINE, NUM_PROFILED_VECTORS };
+
+class ProfilerClass
+{
+public:
+					ProfilerClass ( void );
+	void			Begin ( void );										// starts Timer1 free running, call from setup
+	void			Record ( uint8_t uiVector, uint16_t uiTicks );		// called at end of an interrupt routine
+	void			RecordCritical ( uint16_t uiTicks );				// called once interrupts are back on after an interrupt free section
+	void			Reset ( void );
+	void			Dump ( void );										// prints stats in microseconds to Serial
+
+protected:
+	typedef struct
+	{
+		uint32_t		ulCount;
+		uint32_t		ulTotal;										// ticks, halved along with ulCount if it gets too big so average stays right
+		uint16_t		uiMin;
+		uint16_t		uiMax;
+		uint16_t		auiBuckets [ PROFILE_BUCKETS ];					// saturate at 0xFFFF
+	} PROFILE_STATS;
+
+	void			Add ( PROFILE_STATS* pStats, uint16_t uiTicks );
+	void			DumpStats ( const __FlashStringHelper* pName, PROFILE_STATS* pStats );
+
+	PROFILE_STATS	m_aVectors [ NUM_PROFILED_VECTORS ];
+	PROFILE_STATS	m_Critical;
+};
+
+extern ProfilerClass TheProfiler;
+
+// Timer1 counter is free running so unsigned differences are correct across its wrap as long as the time measured is under 32ms
+#define		PROFILE_ISR_START()						uint16_t uiProfileStart = TCNT1
+#define		PROFILE_ISR_END( uiVector )				TheProfiler.Record ( uiVector, TCNT1 - uiProfileStart )
+// only the outermost section is recorded, nested ones and those in interrupt routines are part of a longer window
+#define		PROFILE_CRITICAL_START()				uint16_t uiProfileCritical = TCNT1
+#define		PROFILE_CRITICAL_END()					uiProfileCritical = TCNT1 - uiProfileCritical
+#define		PROFILE_CRITICAL_RECORD( uiSREG )		if ( ( uiSREG ) & ( 1 << SREG_I ) ) TheProfiler.RecordCritical ( uiProfileCritical )
+
+#else
+
+#define		PROFILE_ISR_START()
+#define		PROFILE_ISR_END( uiVector )
+#define		PROFILE_CRITICAL_START()
+#define		PROFILE_CRITICAL_END()
+#define		PROFILE_CRITICAL_RECORD( uiSREG )
+
+#endif
+#endif
+
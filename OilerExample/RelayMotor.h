@@ -15,7 +15,7 @@
 #endif
 #include "Motor.h"
 
-class RelayMotorClass : MotorClass
+class RelayMotorClass final : public MotorClass
 {
 public:
 						RelayMotorClass ( uint8_t uiPin );
@@ -0,0 +1,162 @@
+//
+//  Scheduler.cpp
+//
+// (c) Mark Naylor June 2021
+//
+//	Implements the cooperative task scheduler run from the sketch loop, see Scheduler.h
+//
+
+#include "Scheduler.h"
+#include "Timer.h"
+
+SchedulerClass::SchedulerClass ( void )
+{
+	m_uiTaskCount = 0;
+	for ( uint8_t i = 0; i < MAX_TASKS; i++ )
+	{
+		m_aTasks [ i ].bInUse = false;
+	}
+}
+
+int8_t SchedulerClass::AddTask ( const __FlashStringHelper* pName, TaskRoutine Routine, uint16_t uiPeriodms, uint8_t uiPriority, uint16_t uiBudgetus )
+{
+	int8_t iResult = INVALID_TASK;
+
+	if ( Routine != NULL )
+	{
+		for ( uint8_t i = 0; i < MAX_TASKS; i++ )
+		{
+			if ( !m_aTasks [ i ].bInUse )
+			{
+				m_aTasks [ i ].pName		= pName;
+				m_aTasks [ i ].pRoutine		= Routine;
+				m_aTasks [ i ].uiPeriodms	= uiPeriodms;
+				m_aTasks [ i ].uiPriority	= uiPriority;
+				m_aTasks [ i ].uiBudgetus	= uiBudgetus;
+				m_aTasks [ i ].ulNextRunms	= millis ();
+				m_aTasks [ i ].ulRuns		= 0;
+				m_aTasks [ i ].ulMaxus		= 0;
+				m_aTasks [ i ].uiOverruns	= 0;
+				m_aTasks [ i ].bInUse		= true;
+
+				// insert after tasks of the same or higher priority so equal priorities run in the order they were added
+				uint8_t uiPos = m_uiTaskCount;
+				while ( uiPos > 0 && m_aTasks [ m_auiOrder [ uiPos - 1 ] ].uiPriority > uiPriority )
+				{
+					m_auiOrder [ uiPos ] = m_auiOrder [ uiPos - 1 ];
+					uiPos--;
+				}
+				m_auiOrder [ uiPos ] = i;
+				m_uiTaskCount++;
+				iResult = i;
+				break;
+			}
+		}
+	}
+	return iResult;
+}
+
+bool SchedulerClass::RemoveTask ( int8_t iTask )
+{
+	bool bResult = false;
+
+	if ( iTask >= 0 && iTask < MAX_TASKS && m_aTasks [ iTask ].bInUse )
+	{
+		uint8_t uiPos = 0;
+		while ( m_auiOrder [ uiPos ] != iTask )
+		{
+			uiPos++;
+		}
+		for ( ; uiPos < m_uiTaskCount - 1; uiPos++ )
+		{
+			m_auiOrder [ uiPos ] = m_auiOrder [ uiPos + 1 ];
+		}
+		m_uiTaskCount--;
+		m_aTasks [ iTask ].bInUse = false;
+		bResult = true;
+	}
+	return bResult;
+}
+
+void SchedulerClass::Run ( void )
+{
+	for ( uint8_t i = 0; i < m_uiTaskCount; i++ )
+	{
+		TASK* pTask = &m_aTasks [ m_auiOrder [ i ] ];
+
+		if ( TimerClass::IsDue ( millis (), pTask->ulNextRunms ) )
+		{
+			uint32_t ulStart = micros ();
+			pTask->pRoutine ();
+			uint32_t ulTook = micros () - ulStart;
+
+			pTask->ulRuns++;
+			if ( ulTook > pTask->ulMaxus )
+			{
+				pTask->ulMaxus = ulTook;
+			}
+			if ( ulTook > pTask->uiBudgetus && pTask->uiOverruns != 0xFFFF )
+			{
+				pTask->uiOverruns++;
+			}
+			// keep to the period, but if a whole period has been missed start again from now rather than running repeatedly to catch up
+			pTask->ulNextRunms += pTask->uiPeriodms;
+			if ( pTask->uiPeriodms > 0 && TimerClass::IsDue ( millis (), pTask->ulNextRunms ) )
+			{
+				pTask->ulNextRunms = millis () + pTask->uiPeriodms;
+			}
+		}
+	}
+}
+
+uint16_t SchedulerClass::GetOverruns ( int8_t iTask )
+{
+	uint16_t uiResult = 0;
+
+	if ( iTask >= 0 && iTask < MAX_TASKS && m_aTasks [ iTask ].bInUse )
+	{
+		uiResult = m_aTasks [ iTask ].uiOverruns;
+	}
+	return uiResult;
+}
+
+uint16_t SchedulerClass::GetTotalOverruns ( void )
+{
+	uint16_t uiResult = 0;
+
+	for ( uint8_t i = 0; i < m_uiTaskCount; i++ )
+	{
+		uiResult += m_aTasks [ m_auiOrder [ i ] ].uiOverruns;
+	}
+	return uiResult;
+}
+
+void SchedulerClass::Reset ( void )
+{
+	for ( uint8_t i = 0; i < MAX_TASKS; i++ )
+	{
+		m_aTasks [ i ].ulRuns		= 0;
+		m_aTasks [ i ].ulMaxus		= 0;
+		m_aTasks [ i ].uiOverruns	= 0;
+	}
+}
+
+void SchedulerClass::Dump ( void )
+{
+	Serial.print ( F ( "\nTasks:" ) ); Serial.print ( m_uiTaskCount );
+	for ( uint8_t i = 0; i < m_uiTaskCount; i++ )
+	{
+		TASK* pTask = &m_aTasks [ m_auiOrder [ i ] ];
+
+		Serial.print ( F ( "\n" ) ); Serial.print ( pTask->pName );
+		Serial.print ( F ( " Priority: " ) ); Serial.print ( pTask->uiPriority );
+		Serial.print ( F ( " Period(ms): " ) ); Serial.print ( pTask->uiPeriodms );
+		Serial.print ( F ( " Budget(us): " ) ); Serial.print ( pTask->uiBudgetus );
+		Serial.print ( F ( " Runs: " ) ); Serial.print ( pTask->ulRuns );
+		Serial.print ( F ( " Max(us): " ) ); Serial.print ( pTask->ulMaxus );
+		Serial.print ( F ( " Overruns: " ) ); Serial.print ( pTask->uiOverruns );
+	}
+	Serial.println ();
+}
+
+SchedulerClass TheScheduler;
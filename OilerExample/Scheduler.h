@@ -0,0 +1,60 @@
+//
+//  Scheduler.h
+//
+// (c) Mark Naylor June 2021
+//
+//	This class implements a simple cooperative task scheduler for the sketch loop. A task is a routine that does a bounded slice of work and returns,
+//	if it has more to do it keeps its own state and carries on from there next time it is called. Each task has a period, a priority and a time budget.
+//	Each call to Run runs every task that is due once, highest priority first, so a busy task can delay others but never starve them.
+//	The time each task takes is measured and a task that takes longer than its budget is counted as an overrun, these can be printed with Dump.
+//
+#ifndef _SCHEDULER_h
+#define _SCHEDULER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include <Arduino.h>
+#else
+	#include "WProgram.h"
+#endif
+
+#define		MAX_TASKS			8
+#define		INVALID_TASK		-1
+
+typedef void ( *TaskRoutine )( void );
+
+class SchedulerClass
+{
+public:
+						SchedulerClass ( void );
+	int8_t				AddTask ( const __FlashStringHelper* pName, TaskRoutine Routine, uint16_t uiPeriodms, uint8_t uiPriority, uint16_t uiBudgetus );	// period 0 runs every pass, priority 0 is highest, returns INVALID_TASK if full
+	bool				RemoveTask ( int8_t iTask );
+	void				Run ( void );									// call from loop, runs each due task once
+	uint16_t			GetOverruns ( int8_t iTask );
+	uint16_t			GetTotalOverruns ( void );
+	void				Reset ( void );									// clears measurements
+	void				Dump ( void );									// prints task measurements to Serial
+
+protected:
+	typedef struct
+	{
+		const __FlashStringHelper*	pName;
+		TaskRoutine					pRoutine;
+		uint32_t					ulNextRunms;
+		uint16_t					uiPeriodms;
+		uint16_t					uiBudgetus;
+		uint32_t					ulRuns;
+		uint32_t					ulMaxus;							// longest single run
+		uint16_t					uiOverruns;							// runs that exceeded budget, saturates at 0xFFFF
+		uint8_t						uiPriority;
+		bool						bInUse;
+	} TASK;
+
+	TASK				m_aTasks [ MAX_TASKS ];
+	uint8_t				m_auiOrder [ MAX_TASKS ];						// task ids in priority order
+	uint8_t				m_uiTaskCount;
+};
+
+extern SchedulerClass TheScheduler;
+
+#endif
+
@@ -0,0 +1,256 @@
+//
+// StepDirMotor.cpp
+//
+// (c) Mark Naylor June 2021
+//
+//	Implementation of STEP / DIR driver motor as derivative of Motor, see StepDirMotor.h
+//
+
+#include "StepDirMotor.h"
+#include "Timer.h"
+#include "Profiler.h"
+
+StepDirMotorClass* StepDirMotorClass::m_pInstance = NULL;
+
+StepDirMotorClass::StepDirMotorClass ( uint8_t uiDirPin, uint32_t ulSpeed ) : MotorClass ( ulSpeed )
+{
+	m_uiDirPin				= uiDirPin;
+	m_eStatus				= STOPPED;
+	m_bPulseHigh			= false;
+	m_ulSteps				= 0;
+	m_uiCruiseHalfTicks		= IntervalToHalfTicks ( ulSpeed );
+	m_uiHalfTicks			= m_uiCruiseHalfTicks;
+	m_uiRampEntries			= 0;
+	m_uiRampIndex			= 0;
+	m_uiStepsPerEntry		= 0;
+	m_uiRampCount			= 0;
+	if ( m_pInstance == NULL )
+	{
+		m_pInstance = this;
+		// the pin reads its PORT bit, low, whenever OC1B is disconnected
+		digitalWrite ( STEPDIR_STEP_PIN, LOW );
+		pinMode ( STEPDIR_STEP_PIN, OUTPUT );
+	}
+	pinMode ( m_uiDirPin, OUTPUT );
+	SetDirection ( FORWARD );
+}
+
+void StepDirMotorClass::SetDirection ( eDirection Direction )
+{
+	m_eDir = Direction;
+	digitalWrite ( m_uiDirPin, m_eDir == FORWARD ? HIGH : LOW );
+}
+
+bool StepDirMotorClass::On ( void )
+{
+	bool bResult = false;
+
+	if ( m_pInstance == this )
+	{
+		// keeps Timer1 running whether or not TheStepTimer has callbacks
+		TheStepTimer.GetTicks ();
+
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		if ( m_eStatus == STOPPED )
+		{
+			m_uiRampIndex	= 0;
+			m_uiRampCount	= m_uiStepsPerEntry;
+			m_uiHalfTicks	= m_uiRampEntries > 0 ? m_auiRamp [ 0 ] : m_uiCruiseHalfTicks;
+			m_bPulseHigh	= false;
+
+			// force OC1B low with clear on match, then toggle from there, so the first match always starts a pulse
+			TCCR1A = ( TCCR1A & ~( ( 1 << COM1B1 ) | ( 1 << COM1B0 ) ) ) | ( 1 << COM1B1 );
+			TCCR1C = ( 1 << FOC1B );
+			TCCR1A = ( TCCR1A & ~( 1 << COM1B1 ) ) | ( 1 << COM1B0 );
+			OCR1B = TCNT1 + STEPDIR_MIN_LEAD_TICKS;
+			TIFR1 = ( 1 << OCF1B );
+			TIMSK1 |= ( 1 << OCIE1B );
+			m_eStatus = MOVING;
+			MotorClass::On ();
+		}
+		else if ( m_eStatus == STOPPING )
+		{
+			// picks up the ramp from where it had slowed to
+			m_eStatus = MOVING;
+		}
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
+		bResult = true;
+	}
+	return bResult;
+}
+
+bool StepDirMotorClass::Off ( void )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	if ( m_eStatus == MOVING )
+	{
+		if ( m_uiRampEntries == 0 && !m_bPulseHigh )
+		{
+			Stop ();
+		}
+		else
+		{
+			// the interrupt stops it once the pulse has ended and any ramp has slowed down
+			m_eStatus = STOPPING;
+		}
+	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+	return true;
+}
+
+// called with interrupts off and STEP low, the pin then follows its PORT bit and stays low. A motor that was STOPPING is stopped by the
+// interrupt after Off returned so says so
+void StepDirMotorClass::Stop ( void )
+{
+	bool bLate = m_eStatus == STOPPING;
+
+	TIMSK1 &= ~( 1 << OCIE1B );
+	TCCR1A &= ~( ( 1 << COM1B1 ) | ( 1 << COM1B0 ) );
+	m_eStatus = STOPPED;
+	MotorClass::Off ();
+	if ( bLate )
+	{
+		MotorClass::Stopped ();
+	}
+}
+
+// Constant acceleration from the start speed means speed squared goes up evenly with each step, speed is taken as STEPDIR_SPEED_SCALE over
+// the half interval so the half interval a fraction f of the way along the ramp is Scale / sqrt ( Start^2 + ( Cruise^2 - Start^2 ) * f )
+bool StepDirMotorClass::SetRamp ( uint32_t ulStartSpeed, uint16_t uiRampSteps )
+{
+	bool bResult = false;
+
+	if ( m_eStatus == STOPPED )
+	{
+		uint16_t	uiStartHalf	= IntervalToHalfTicks ( ulStartSpeed );
+
+		m_uiRampEntries = 0;
+		if ( uiRampSteps > 0 && uiStartHalf > m_uiCruiseHalfTicks )
+		{
+			uint8_t		uiEntries	= uiRampSteps < STEPDIR_RAMP_ENTRIES ? uiRampSteps : STEPDIR_RAMP_ENTRIES;
+			uint32_t	ulStart		= STEPDIR_SPEED_SCALE / uiStartHalf;
+			uint32_t	ulCruise	= STEPDIR_SPEED_SCALE / m_uiCruiseHalfTicks;
+			uint32_t	ulStartSq	= ulStart * ulStart;
+			uint32_t	ulStep		= ( ulCruise * ulCruise - ulStartSq ) / uiEntries;
+
+			for ( uint8_t i = 0; i < uiEntries; i++ )
+			{
+				uint32_t ulHalf = STEPDIR_SPEED_SCALE / SquareRoot ( ulStartSq + ulStep * i );
+				m_auiRamp [ i ] = ulHalf > 0xFFFF ? 0xFFFF : ulHalf;
+			}
+			m_uiStepsPerEntry = ( uiRampSteps + uiEntries - 1 ) / uiEntries;
+			m_uiRampEntries = uiEntries;
+		}
+		bResult = true;
+	}
+	return bResult;
+}
+
+uint32_t StepDirMotorClass::GetSteps ( void )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	uint32_t ulResult = m_ulSteps;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return ulResult;
+}
+
+MotorClass::eState StepDirMotorClass::GetMotorState ( void )
+{
+	return MotorClass::GetMotorState ();
+}
+
+bool StepDirMotorClass::IsFree ( void )
+{
+	return m_pInstance == NULL;
+}
+
+uint16_t StepDirMotorClass::IntervalToHalfTicks ( uint32_t ulMicros )
+{
+	uint32_t ulHalf = TheStepTimer.MicrosToTicks ( ulMicros ) >> 1;
+
+	if ( ulHalf < STEPDIR_MIN_HALF_TICKS )
+	{
+		ulHalf = STEPDIR_MIN_HALF_TICKS;
+	}
+	return ulHalf > 0xFFFF ? 0xFFFF : ulHalf;
+}
+
+void StepDirMotorClass::CompareB ( void )
+{
+	m_pInstance->Toggled ();
+}
+
+// Runs in interrupt context just after the hardware toggled STEP
+void StepDirMotorClass::Toggled ( void )
+{
+	m_bPulseHigh = !m_bPulseHigh;
+	if ( !m_bPulseHigh )
+	{
+		m_ulSteps++;
+		Ramp ();
+	}
+	if ( m_eStatus != STOPPED )
+	{
+		uint16_t uiNext = OCR1B + m_uiHalfTicks;
+		uint16_t uiLead = uiNext - TCNT1;
+
+		// unsigned so half intervals over 32767 ticks work, a lead longer than the half interval means the counter has already passed uiNext
+		if ( uiLead < STEPDIR_MIN_LEAD_TICKS || uiLead > m_uiHalfTicks )
+		{
+			// held off too long, stretch this half rather than let the counter pass the match and go round again
+			uiNext = TCNT1 + STEPDIR_MIN_LEAD_TICKS;
+		}
+		OCR1B = uiNext;
+	}
+}
+
+// Runs in interrupt context at the end of each pulse, so a new half interval applies to the whole of the next step
+void StepDirMotorClass::Ramp ( void )
+{
+	if ( m_eStatus == MOVING )
+	{
+		if ( m_uiRampIndex < m_uiRampEntries && --m_uiRampCount == 0 )
+		{
+			m_uiRampIndex++;
+			m_uiRampCount = m_uiStepsPerEntry;
+			m_uiHalfTicks = m_uiRampIndex < m_uiRampEntries ? m_auiRamp [ m_uiRampIndex ] : m_uiCruiseHalfTicks;
+		}
+	}
+	else if ( m_uiRampEntries == 0 )
+	{
+		Stop ();
+	}
+	else if ( --m_uiRampCount == 0 )
+	{
+		if ( m_uiRampIndex == 0 )
+		{
+			Stop ();
+		}
+		else
+		{
+			m_uiRampIndex--;
+			m_uiRampCount = m_uiStepsPerEntry;
+			m_uiHalfTicks = m_auiRamp [ m_uiRampIndex ];
+		}
+	}
+}
+
+ISR ( TIMER1_COMPB_vect )
+{
+	PROFILE_ISR_START ();
+	StepDirMotorClass::CompareB ();
+	PROFILE_ISR_END ( PROFILE_TIMER1_COMPB );
+}
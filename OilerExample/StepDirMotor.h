@@ -0,0 +1,75 @@
+//
+// StepDirMotor.h
+//
+// (c) Mark Naylor June 2021
+//
+//	Defines a motor driven by a STEP / DIR stepper driver such as the A4988 or DRV8825 as a derivative of Motor, so bigger pumps can be
+//	microstepped at high step rates.
+//
+//	The STEP pulses are made by Timer1's output compare B, not by software writing the pin. While the motor runs the OC1B pin is set to toggle
+//	each time the counter matches OCR1B, every match interrupt adds half the step interval to OCR1B, so two matches make one step. The edges are
+//	placed by the hardware from the previous match rather than from when the interrupt ran, so steps are evenly spaced however late the
+//	interrupt is, as long as it runs within half an interval, if not that half is stretched rather than waiting a whole counter cycle for the
+//	match. The interrupt only does an add and a few compares. Each high pulse is half the step interval, far longer than the drivers
+//	need. Timer1 is kept running by TheStepTimer, channel A carries on timing its callbacks undisturbed.
+//
+//	DIR is written by SetDirection. Steps issued since the motor was made are counted when each pulse ends, see GetSteps. A ramp can be set
+//	with SetRamp in the same way as FourPinStepperMotorClass, it is worked out as half intervals when set so the interrupt only looks them up,
+//	speeds only change and the motor only stops when the STEP pin is low, so a pulse is never cut short.
+//
+//	NB STEP must be wired to D10 (OC1B) and only one StepDirMotorClass can drive it, later ones never step. If TheInputExpander is also used
+//	move its load pin off D10. Step intervals are from 2 * STEPDIR_MIN_HALF_TICKS to 2 * 65535 TheStepTimer ticks, 25us to 65ms
+//
+#ifndef _STEPDIRMOTOR_h
+#define _STEPDIRMOTOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include <Arduino.h>
+#else
+	#include "WProgram.h"
+#endif
+#include "Motor.h"
+
+#define		STEPDIR_STEP_PIN			10								// OC1B, fixed by the hardware
+#define		STEPDIR_MIN_HALF_TICKS		25								// shortest half step interval, 12.5us so up to 40k steps a second
+#define		STEPDIR_MIN_LEAD_TICKS		8								// a match is never set closer than this to the counter so it can't be passed before it is written
+#define		STEPDIR_RAMP_ENTRIES		16								// half intervals in an acceleration ramp
+#define		STEPDIR_RAMP_START_SPEED	1000							// step interval in us ramps start from when added by OilerClass::AddMotor
+#define		STEPDIR_SPEED_SCALE			1048576UL						// divided by a half interval to give a speed whose square fits 32 bits
+
+class StepDirMotorClass final : public MotorClass
+{
+public:
+	enum				eStatus { MOVING, STOPPED, STOPPING };
+						StepDirMotorClass ( uint8_t uiDirPin, uint32_t ulSpeed );		// ulSpeed is the step interval in us
+	void				SetDirection ( eDirection Direction );
+	bool				SetRamp ( uint32_t ulStartSpeed, uint16_t uiRampSteps );		// start interval in us and steps taken to reach speed, 0 steps for no ramp, only while stopped
+	uint32_t			GetSteps ( void );												// steps issued since constructed
+	bool				On ( void );
+	bool				Off ( void );													// with a ramp slows to a stop, without stops at the end of the current pulse
+	MotorClass::eState	GetMotorState ( void );
+	static bool			IsFree ( void );												// true if no motor has OC1B yet
+	static void			CompareB ( void );												// called by the TIMER1_COMPB interrupt
+
+protected:
+	static uint16_t		IntervalToHalfTicks ( uint32_t ulMicros );						// clamped to STEPDIR_MIN_HALF_TICKS - 0xFFFF
+	void				Toggled ( void );												// OC1B has just toggled
+	void				Ramp ( void );													// after each pulse, moves along the ramp and sets the next half interval
+	void				Stop ( void );													// disconnects OC1B, called with interrupts off and the pin low
+
+	static StepDirMotorClass*	m_pInstance;										// motor that owns OC1B
+	uint8_t						m_uiDirPin;
+	volatile eStatus			m_eStatus;
+	volatile bool				m_bPulseHigh;										// STEP is high, the next match ends the pulse
+	volatile uint32_t			m_ulSteps;
+	volatile uint16_t			m_uiHalfTicks;										// added to OCR1B at each match
+	uint16_t					m_uiCruiseHalfTicks;								// half interval once ramp is done
+	uint16_t					m_auiRamp [ STEPDIR_RAMP_ENTRIES ];					// half intervals, slowest first
+	uint8_t						m_uiRampEntries;									// entries of m_auiRamp in use, 0 if no ramp
+	uint8_t						m_uiRampIndex;										// entry currently used, m_uiRampEntries when at speed
+	uint16_t					m_uiStepsPerEntry;
+	uint16_t					m_uiRampCount;										// steps left before moving to next entry
+};
+
+#endif
+
@@ -0,0 +1,178 @@
+//
+//  StepEngine.cpp
+//
+// (c) Mark Naylor June 2021
+//
+//	Implements the step engine that times all stepper motors from one timer callback, see StepEngine.h
+//
+
+#include "StepEngine.h"
+#include "Profiler.h"
+
+StepEngineClass::StepEngineClass ( TimerClass* pTimer )
+{
+	m_pTimer	= pTimer;
+	m_hTimer	= INVALID_TIMER;
+	m_uiActive	= 0;
+	for ( uint8_t i = 0; i < MAX_STEP_CHANNELS; i++ )
+	{
+		m_aChannels [ i ].bInUse = false;
+	}
+}
+
+// The accumulator starts at 0 so the first step is one interval after the channel is added
+int8_t StepEngineClass::AddChannel ( TimerContextCallback Routine, void* pContext, uint16_t uiIncrement )
+{
+	int8_t iResult = INVALID_CHANNEL;
+
+	if ( Routine != NULL )
+	{
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		for ( uint8_t i = 0; i < MAX_STEP_CHANNELS; i++ )
+		{
+			if ( !m_aChannels [ i ].bInUse )
+			{
+				if ( m_uiActive == 0 )
+				{
+					m_hTimer = m_pTimer->AddTimer ( Tick, this, m_pTimer->MicrosToTicks ( STEP_ENGINE_TICK_US ) );
+				}
+				if ( m_hTimer != INVALID_TIMER )
+				{
+					m_aChannels [ i ].pRoutine		= Routine;
+					m_aChannels [ i ].pTickRoutine	= NULL;
+					m_aChannels [ i ].pContext		= pContext;
+					m_aChannels [ i ].uiIncrement	= uiIncrement;
+					m_aChannels [ i ].uiAccumulator	= 0;
+					m_aChannels [ i ].bInUse		= true;
+					m_uiActive++;
+					iResult = i;
+				}
+				break;
+			}
+		}
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
+	}
+	return iResult;
+}
+
+bool StepEngineClass::RemoveChannel ( int8_t iChannel )
+{
+	bool bResult = false;
+
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	if ( iChannel >= 0 && iChannel < MAX_STEP_CHANNELS && m_aChannels [ iChannel ].bInUse )
+	{
+		m_aChannels [ iChannel ].bInUse = false;
+		if ( --m_uiActive == 0 )
+		{
+			// nothing left to step, don't keep interrupting
+			m_pTimer->RemoveTimer ( m_hTimer );
+			m_hTimer = INVALID_TIMER;
+		}
+		bResult = true;
+	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return bResult;
+}
+
+bool StepEngineClass::SetIncrement ( int8_t iChannel, uint16_t uiIncrement )
+{
+	bool bResult = false;
+
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	if ( iChannel >= 0 && iChannel < MAX_STEP_CHANNELS && m_aChannels [ iChannel ].bInUse )
+	{
+		m_aChannels [ iChannel ].uiIncrement = uiIncrement;
+		bResult = true;
+	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return bResult;
+}
+
+bool StepEngineClass::SetTickRoutine ( int8_t iChannel, StepTickCallback Routine )
+{
+	bool bResult = false;
+
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	if ( iChannel >= 0 && iChannel < MAX_STEP_CHANNELS && m_aChannels [ iChannel ].bInUse )
+	{
+		m_aChannels [ iChannel ].pTickRoutine = Routine;
+		bResult = true;
+	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return bResult;
+}
+
+uint8_t StepEngineClass::GetActiveChannels ( void )
+{
+	return m_uiActive;
+}
+
+TimerClass* StepEngineClass::GetTimer ( void )
+{
+	return m_pTimer;
+}
+
+uint16_t StepEngineClass::IntervalToIncrement ( uint32_t ulMicros )
+{
+	uint16_t uiResult = 0xFFFF;
+
+	if ( ulMicros > STEP_ENGINE_TICK_US )
+	{
+		uint32_t ulIncrement = ( 65536UL * STEP_ENGINE_TICK_US + ( ulMicros >> 1 ) ) / ulMicros;
+		uiResult = ulIncrement > 0 ? ulIncrement : 1;
+	}
+	return uiResult;
+}
+
+void StepEngineClass::Tick ( void* pContext )
+{
+	( ( StepEngineClass* ) pContext )->Pass ();
+}
+
+// Runs in interrupt context. A routine may remove its own channel, the loop just skips it from then on
+void StepEngineClass::Pass ( void )
+{
+	PROFILE_ISR_START ();
+	for ( uint8_t i = 0; i < MAX_STEP_CHANNELS; i++ )
+	{
+		CHANNEL* pChannel = &m_aChannels [ i ];
+
+		if ( pChannel->bInUse )
+		{
+			uint16_t uiLast = pChannel->uiAccumulator;
+
+			pChannel->uiAccumulator += pChannel->uiIncrement;
+			if ( pChannel->uiAccumulator < uiLast )
+			{
+				pChannel->pRoutine ( pChannel->pContext );
+			}
+			if ( pChannel->bInUse && pChannel->pTickRoutine != NULL )
+			{
+				pChannel->pTickRoutine ( pChannel->pContext, pChannel->uiAccumulator, pChannel->uiIncrement );
+			}
+		}
+	}
+	PROFILE_ISR_END ( PROFILE_STEP_ENGINE );
+}
+
+StepEngineClass TheStepEngine ( &TheStepTimer );
@@ -0,0 +1,71 @@
+//
+//  StepEngine.h
+//
+// (c) Mark Naylor June 2021
+//
+//	This class makes the step decisions for every running stepper motor from a single periodic timer callback, rather than each motor having a
+//	timer entry of its own. Each motor is a channel with a 16 bit accumulator and an increment proportional to its step rate, every tick the
+//	increment is added to the accumulator and the motor steps when it carries, so a tick costs one add and compare per motor however many are
+//	running and at whatever rates (a digital differential analyser). An increment of 65536 would step every tick, so with the default
+//	100us tick a motor's step interval is kept to within 100us of what was asked for, with the error spread evenly rather than building up.
+//
+//	Channels call their routine in turn on the same tick, motors that write their pins through the timer's service hook have all their steps
+//	for the tick written together. The engine's timer entry only exists while a channel is in use. The time taken by each tick is measured by
+//	TheProfiler as the "Step engine" entry.
+//
+//	A channel can also be given a tick routine, run every tick after any step and passed the channel's accumulator and increment, so a motor
+//	can tell how far it is between steps and act on it, such as turning its coils down while it waits for the next one.
+//
+#ifndef _STEPENGINE_h
+#define _STEPENGINE_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include <Arduino.h>
+#else
+	#include "WProgram.h"
+#endif
+#include "Timer.h"
+#include "Motor.h"
+
+#define		MAX_STEP_CHANNELS		MAX_MOTORS							// one per motor the oiler allows
+#define		STEP_ENGINE_TICK_US		100UL								// time between step decisions, fastest step rate is one a tick
+#define		INVALID_CHANNEL			-1
+
+typedef void ( *StepTickCallback )( void* pContext, uint16_t uiAccumulator, uint16_t uiIncrement );	// uiAccumulator / 65536 is the fraction of the interval since the last step
+
+class StepEngineClass
+{
+public:
+						StepEngineClass ( TimerClass* pTimer );
+	int8_t				AddChannel ( TimerContextCallback Routine, void* pContext, uint16_t uiIncrement );	// Routine is passed pContext on each step, returns INVALID_CHANNEL if none free
+	bool				RemoveChannel ( int8_t iChannel );						// safe to call from the channel's own routine
+	bool				SetIncrement ( int8_t iChannel, uint16_t uiIncrement );	// safe to call from the channel's own routine, applies from the next tick
+	bool				SetTickRoutine ( int8_t iChannel, StepTickCallback Routine );	// Routine is passed the channel's context every tick, NULL for none
+	uint8_t				GetActiveChannels ( void );
+	TimerClass*			GetTimer ( void );
+	static uint16_t		IntervalToIncrement ( uint32_t ulMicros );				// increment for a step every ulMicros, 1 to 0xFFFF
+	static void			Tick ( void* pContext );								// timer callback
+
+protected:
+	void				Pass ( void );
+
+	typedef struct
+	{
+		TimerContextCallback	pRoutine;
+		StepTickCallback		pTickRoutine;
+		void*					pContext;
+		uint16_t				uiIncrement;
+		uint16_t				uiAccumulator;
+		bool					bInUse;
+	} CHANNEL;
+
+	CHANNEL				m_aChannels [ MAX_STEP_CHANNELS ];
+	uint8_t				m_uiActive;
+	TimerClass*			m_pTimer;
+	TimerHandle			m_hTimer;
+};
+
+extern StepEngineClass TheStepEngine;
+
+#endif
+
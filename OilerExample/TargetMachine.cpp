@@ -15,6 +15,7 @@
 //
 #include "PCIHandler.h"
 #include "TargetMachine.h"
+#include "Profiler.h"
 
 
 // #define IsInThisPCIR( digitalPin, Port ) ( digitalPinToPort ( digitalPin ) -  2 == Port ? true: false)
@@ -25,6 +26,9 @@ void MachineActiveSignal ( void )
 	TheMachine.CheckActivity ();
 }
 
+// Glitches and switch bounce on the work pin are filtered out before MachineWorkUnitSignal is called
+const PIN_FILTER WorkUnitFilter = { MACHINE_WORK_MIN_PULSE, MACHINE_WORK_MIN_GAP, true };
+
 // Routine to be called if MACHINE_WORK_PIN is signalled - called by interrupt
 void MachineWorkUnitSignal ( void )
 {
@@ -33,7 +37,6 @@ void MachineWorkUnitSignal ( void )
 		TheMachine.IncWorkUnit ( 1 );
 	}
 }
-extern uint8_t bPCICount;
 // Class routines
 TargetMachineClass::TargetMachineClass ( void )
 {
@@ -41,6 +44,8 @@ TargetMachineClass::TargetMachineClass ( void )
 	m_uiActivitePin = NOT_A_PIN;
 	m_State			= NOT_READY;
 	m_Active		= IDLE;
+	m_pReadyHandler	= NULL;
+	m_hActiveDeadline = INVALID_TIMER;
 /*
 	m_ulTargetSecs = MACHINE_ACTIVE_TIME_TARGET;		// set default
 	m_ulTargetUnits = WORK_UNITS_TARGET;
@@ -76,6 +81,7 @@ bool TargetMachineClass::AddFeatures  ( uint8_t uiActivePin, uint8_t uiWorkPin,
 	bool bResult = true;
 
 	m_ulTargetSecs	= uiActiveUnitTarget;		
+	m_timeTarget	= TheTimer.SecsToTicks ( m_ulTargetSecs );
 	m_ulTargetUnits = uiWorkUnitTarget;
 	m_uiActivitePin = uiActivePin;
 	m_uiWorkPin		= uiWorkPin;
@@ -97,7 +103,7 @@ bool TargetMachineClass::AddFeatures  ( uint8_t uiActivePin, uint8_t uiWorkPin,
 	}
 	if ( uiWorkPin != NOT_A_PIN )
 	{
-		if ( PCIHandler.AddPin ( uiWorkPin, MachineWorkUnitSignal, MACHINE_WORK_PIN_SIGNAL, MACHINE_WORK_PIN_MODE ) == false )
+		if ( PCIHandler.AddPin ( uiWorkPin, MachineWorkUnitSignal, MACHINE_WORK_PIN_SIGNAL, MACHINE_WORK_PIN_MODE, &WorkUnitFilter, MACHINE_WORK_RATE_HZ ) == false )
 		{
 			bResult = false;
 		}
@@ -107,19 +113,28 @@ bool TargetMachineClass::AddFeatures  ( uint8_t uiActivePin, uint8_t uiWorkPin,
 	return bResult;
 }
 
+// Called from loop via the oiler, counters are also updated by pin change interrupts so hold these off while resetting
 void TargetMachineClass::RestartMonitoring ( void )
 {
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
 	m_timeActive = 0;
 	m_ulWorkUnitCount = 0;
 	if ( m_State != NO_FEATURES )
 	{
 		m_State = NOT_READY;
 		m_Active = m_uiActivitePin == NOT_A_PIN ? IDLE : digitalRead ( m_uiActivitePin ) == MACHINE_ACTIVE_STATE ? ACTIVE : IDLE;
+		CancelActiveDeadline ();
 		if ( m_Active == ACTIVE )
 		{
-			m_timeActiveStarted = millis ();
+			m_timeActiveStarted = TheTimer.GetTicks ();
+			ScheduleActiveDeadline ();
 		}
 	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
 }
 
 void TargetMachineClass::CheckActivity  ( void )
@@ -128,89 +143,208 @@ void TargetMachineClass::CheckActivity  ( void )
 	if ( digitalRead ( m_uiActivitePin ) == MACHINE_ACTIVE_STATE )
 	{
 		// machine gone active so remember when this started
-		TheMachine.GoneActive ( millis() );
+		TheMachine.GoneActive ( TheTimer.GetTicks () );
 	}
 	else
 	{
 		// machine gone idle so calc time was active and save it
-		TheMachine.IncActiveTime ( millis() );
+		TheMachine.IncActiveTime ( TheTimer.GetTicks () );
+		if ( m_Active == IDLE )
+		{
+			CancelActiveDeadline ();
+		}
+	}
+}
+
+void TargetMachineClass::SetReadyHandler ( WorkHandler pHandler )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	m_pReadyHandler = pHandler;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+}
+
+// Called by TheTimer, the active time is brought up to date which raises the ready event. If the target was changed since the deadline
+// was set there may still be time to go
+void TargetMachineClass::ActiveDeadlineCallback ( void* pContext )
+{
+	TargetMachineClass* pMachine = ( TargetMachineClass* ) pContext;
+
+	pMachine->m_hActiveDeadline = INVALID_TIMER;
+	if ( pMachine->m_Active == ACTIVE )
+	{
+		uint64_t tNow = TheTimer.GetTicks ();
+		pMachine->IncActiveTime ( tNow );
+		pMachine->m_timeActiveStarted = tNow;
+		if ( pMachine->m_Active == ACTIVE )
+		{
+			pMachine->ScheduleActiveDeadline ();
+		}
+	}
+}
+
+void TargetMachineClass::ScheduleActiveDeadline ( void )
+{
+	CancelActiveDeadline ();
+	if ( m_uiActivitePin != NOT_A_PIN && m_timeActive < m_timeTarget )
+	{
+		// m_timeActive is counted up to m_timeActiveStarted, add the time active since. The wait is capped well inside the timer's 32 bit
+		// range and rescheduled if needed
+		uint64_t ullDone = m_timeActive + ( TheTimer.GetTicks () - m_timeActiveStarted );
+		uint64_t ullWait = ullDone < m_timeTarget ? m_timeTarget - ullDone : 1;
+
+		m_hActiveDeadline = TheTimer.AddTimer ( ActiveDeadlineCallback, this, ullWait < 0x7FFFFFFFUL ? ( uint32_t ) ullWait : 0x7FFFFFFFUL, TimerClass::ONE_SHOT );
+	}
+}
+
+void TargetMachineClass::CancelActiveDeadline ( void )
+{
+	if ( m_hActiveDeadline != INVALID_TIMER )
+	{
+		TheTimer.RemoveTimer ( m_hActiveDeadline );
+		m_hActiveDeadline = INVALID_TIMER;
+	}
+}
+
+// Only the crossing raises an event, further work or active time while waiting for the oiler doesn't
+void TargetMachineClass::Ready ( eReadyReason Reason )
+{
+	m_State = READY;
+	if ( m_pReadyHandler != NULL )
+	{
+		TheWorkQueue.Post ( m_pReadyHandler, Reason );
 	}
 }
 
 bool TargetMachineClass::MachineUnitsDone ( void )
 {
 	bool bResult = false;
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
 	if ( m_ulWorkUnitCount >= m_ulTargetUnits )
 	{
 		bResult = true;
 	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
 	return bResult;
 }
 
 bool TargetMachineClass::MachinePoweredTimeExpired ( void )
 {
 	bool bResult = false;
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
 	// Check time is up to date
 	if ( m_Active == ACTIVE )
 	{
 		// add time to now and check if passed threshold
-		uint32_t tNow = millis ();
+		uint64_t tNow = TheTimer.GetTicks ();
 		IncActiveTime ( tNow );
 		m_timeActiveStarted = tNow;
 	}
-	if ( m_timeActive / 1000 >= m_ulTargetSecs )
+	if ( m_timeActive >= m_timeTarget )
 	{
 		bResult = true;
 	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
 	return bResult;
 }
 
 TargetMachineClass::eMachineState TargetMachineClass::IsReady ( void )
 {
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
 	// Check time is up to date
 	if ( m_Active == ACTIVE )
 	{
 		// add time to now and check if passed threshold
-		uint32_t tNow = millis ();
+		uint64_t tNow = TheTimer.GetTicks ();
 		IncActiveTime ( tNow );
 		m_timeActiveStarted = tNow;
 	}
-	return m_State;
+	eMachineState Result = m_State;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+	return Result;
 }
 
 uint32_t TargetMachineClass::GetActiveTime ( void )
 {
-	return m_timeActive / 1000;
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	uint64_t ullResult = m_timeActive;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+	return TheTimer.TicksToSecs ( ullResult );
 }
 
 uint32_t TargetMachineClass::GetWorkUnits ( void )
 {
-	return m_ulWorkUnitCount;
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	uint32_t ulResult = m_ulWorkUnitCount;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+	return ulResult;
 }
 
-// add active time in milliseconds to total since machine became active
-void TargetMachineClass::IncActiveTime ( uint32_t tNow )
+// add active time in ticks to total since machine became active
+void TargetMachineClass::IncActiveTime ( uint64_t tNow )
 {
+	bool bWasShort = m_timeActive < m_timeTarget;
+
 	m_timeActive += (tNow - m_timeActiveStarted );
-	if ( m_timeActive / 1000 >= m_ulTargetSecs )
+	if ( m_timeActive >= m_timeTarget )
 	{
-		m_State = READY;
+		if ( bWasShort )
+		{
+			Ready ( ACTIVE_TIME_DONE );
+		}
+		else
+		{
+			m_State = READY;
+		}
 	}
 	m_Active = digitalRead ( m_uiActivitePin ) == MACHINE_ACTIVE_STATE ? ACTIVE : IDLE;
 }
 
-void TargetMachineClass::GoneActive ( uint32_t tNow )
+void TargetMachineClass::GoneActive ( uint64_t tNow )
 {
 	m_Active = ACTIVE;
 	m_timeActiveStarted = tNow;
+	ScheduleActiveDeadline ();
 }
 
 void TargetMachineClass::IncWorkUnit ( uint32_t ulIncAmoount )
 {
+	bool bWasShort = m_ulWorkUnitCount < m_ulTargetUnits;
+
 	m_ulWorkUnitCount += ulIncAmoount;
 	if ( m_ulWorkUnitCount >= m_ulTargetUnits )
 	{
-		m_State = READY;
+		if ( bWasShort )
+		{
+			Ready ( WORK_UNITS_DONE );
+		}
+		else
+		{
+			m_State = READY;
+		}
 	}
 }
 
@@ -219,7 +353,25 @@ bool TargetMachineClass::SetActiveTimeTarget ( uint32_t ulTargetSecs )
 	bool bResult = false;
 	if ( m_uiActivitePin != NOT_A_PIN )
 	{
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		bool bWasShort = m_timeActive < m_timeTarget;
+
 		m_ulTargetSecs = ulTargetSecs;
+		m_timeTarget = TheTimer.SecsToTicks ( ulTargetSecs );
+		if ( m_Active == ACTIVE )
+		{
+			ScheduleActiveDeadline ();
+		}
+		// a lower target the machine has already passed is a crossing too, there is no deadline or pin change to see it
+		if ( bWasShort && m_timeActive >= m_timeTarget )
+		{
+			Ready ( ACTIVE_TIME_DONE );
+		}
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
 		bResult = true;
 	}
 	return bResult;
@@ -230,7 +382,20 @@ bool TargetMachineClass::SetWorkTarget ( uint32_t ulTargetUnits )
 	bool bResult = false;
 	if ( m_uiWorkPin != NOT_A_PIN )
 	{
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		bool bWasShort = m_ulWorkUnitCount < m_ulTargetUnits;
+
 		m_ulTargetUnits = ulTargetUnits;
+		// a lower target the count has already passed is a crossing too, the next work unit wouldn't report it
+		if ( bWasShort && m_ulWorkUnitCount >= m_ulTargetUnits )
+		{
+			Ready ( WORK_UNITS_DONE );
+		}
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
 		bResult = true;
 	}
 	return bResult;
@@ -13,6 +13,10 @@
 //
 // The class keeps track of active time and number of units of work completed. These are optional inputs for the Oiler class to refine when it delivers oil.
 //
+// When either target is reached the ready handler is posted to TheWorkQueue straight away, with the eReadyReason as its parameter, so the oiler
+// doesn't have to poll. Work units are counted by the work pin's interrupt so are seen as they happen. Active time only changes while the machine
+// is active, so going active sets a one shot TheTimer deadline for when the remaining time will be used up, cancelled if it goes idle first
+//
 #ifndef _TARGETMACHINE_h
 #define _TARGETMACHINE_h
 
@@ -21,6 +25,8 @@
 #else
 #include "WProgram.h"
 #endif
+#include "Timer.h"
+#include "WorkQueue.h"
 
 
 #define		MACHINE_ACTIVE_PIN_MODE		INPUT_PULLUP		// Change to INPUT if internal Arduino pullups not needed
@@ -28,6 +34,9 @@
 #define		MACHINE_ACTIVE_STATE		HIGH				// signal HIGH when machine is active, change to LOW if that is how target machine works
 #define		MACHINE_WORK_PIN_MODE		INPUT_PULLUP		// Change to INPUT if internal Arduino pullups not needed
 #define		MACHINE_WORK_PIN_SIGNAL		FALLING				// signal FALLS when unit completed, change to RISING if that is how target machine works
+#define		MACHINE_WORK_MIN_PULSE		200UL				// microseconds, work signal must be steady this long before a unit is counted
+#define		MACHINE_WORK_MIN_GAP		0UL					// microseconds, set if the fastest rate of work units is known, the filter also learns the typical rate
+#define		MACHINE_WORK_RATE_HZ		HIGH_RATE_HZ		// expected work units a second, at this rate the work pin gets its own interrupt if it is D2 or D3
 
 
 typedef void ( *InterruptCallback )( void );
@@ -37,6 +46,7 @@ class TargetMachineClass
 public:
 	enum eMachineState	{ READY, NOT_READY, NO_FEATURES };		// Ready to be oiled or can't tell
 	enum eActiveState	{ IDLE, ACTIVE };
+	enum eReadyReason	{ WORK_UNITS_DONE, ACTIVE_TIME_DONE };	// parameter of the ready handler
 					TargetMachineClass ( void );
 	bool			AddFeatures ( uint8_t uiActivePin, uint8_t uiWorkPin, uint8_t uiActiveUnitTarget, uint8_t uiWorkUnitTarget );
 	void			RestartMonitoring ( void );
@@ -46,17 +56,26 @@ public:
 	eMachineState	IsReady ( void );
 	uint32_t		GetActiveTime ( void );						// Active time in secs since oiler stopped
 	uint32_t		GetWorkUnits ( void );						// number of work units since oiler stopped
-	void			IncActiveTime ( uint32_t tActive );
-	void			GoneActive ( uint32_t tNow );
+	void			IncActiveTime ( uint64_t tNow );			// times in TheTimer ticks
+	void			GoneActive ( uint64_t tNow );
 	void			IncWorkUnit ( uint32_t ulIncAmoount );
-	bool			SetActiveTimeTarget ( uint32_t ulTargetSecs );
-	bool			SetWorkTarget ( uint32_t ulTargetUnits );
+	bool			SetActiveTimeTarget ( uint32_t ulTargetSecs );	// a target already reached raises the ready event now
+	bool			SetWorkTarget ( uint32_t ulTargetUnits );			// a target already reached raises the ready event now
 	void			CheckActivity ( void );						// check activity after change in signal from machine
+	void			SetReadyHandler ( WorkHandler pHandler );	// posted each time a target is reached, NULL for none
+	static void		ActiveDeadlineCallback ( void* pContext );	// called by TheTimer when active time should have reached its target
 protected:
+	void			ScheduleActiveDeadline ( void );			// called with interrupts off while active
+	void			CancelActiveDeadline ( void );				// called with interrupts off
+	void			Ready ( eReadyReason Reason );				// called with interrupts off when a target is crossed
+
+	WorkHandler		m_pReadyHandler;
+	TimerHandle		m_hActiveDeadline;							// INVALID_TIMER when not waiting for the active time target
 	eMachineState	m_State;
 	eActiveState	m_Active;
-	uint32_t		m_timeActive;								// time machine has been active since monitor reset
-	uint32_t		m_timeActiveStarted;						// time machine last went active
+	uint64_t		m_timeActive;								// ticks machine has been active since monitor reset
+	uint64_t		m_timeActiveStarted;						// ticks when machine last went active
+	uint64_t		m_timeTarget;								// m_ulTargetSecs in ticks, saves a 64 bit divide in the interrupt
 	uint32_t		m_ulWorkUnitCount;
 	uint32_t		m_ulTargetSecs;
 	uint32_t		m_ulTargetUnits;
@@ -1,103 +1,291 @@
-// 
-// 
-// This implements a timer class that encapsulates a microsecond timer that has functions to call at given intervals. Its set to a resolution of 2000 ticks per sec
+//
+//
+// This implements a timer class that encapsulates a microsecond timer that has functions to call at given intervals. It only interrupts when a callback is
+// due or the hardware counter overflows. TheTimer uses Timer2 at 15625 ticks per sec, TheStepTimer uses Timer1 at 2000000 ticks per sec.
+// TheTimer is also the system clock, once used as such it overflows 61 times a second with nothing queued
 //
 // (c) Mark Naylor June 2021
-// 
+//
 
 #include "Timer.h"
+#include "Profiler.h"
 
-TimerClass::TimerClass ( void )
-{
-	m_uiCallbackCount = 0;
-	/*
-	*	This code is designed for Arduino Uno only!!!!
-	*
-	*/
-	noInterrupts ();
-
-	//set timer2 interrupt at 4kHz
-	TCCR2A = 0;				// set entire TCCR2A register to 0
-	TCCR2B = 0;				// same for TCCR2B
-	TCNT2 = 0;				//initialize counter value to 0
+#define SLOT_MASK		0x0F
+#define SEQUENCE_LIMIT	15			// sequence of 15 in slot 15 would make INVALID_TIMER
 
-	// set compare match register for 4khz increments
-	OCR2A = 108;				// = (16*10^6) / (4000*64) - 1 (must be <256)
+TimerClass::TimerClass ( uint32_t ulResolution, uint8_t uiCounterBits )
+{
+	m_ulResolution		= ulResolution;
+	m_ulCounterRange	= 1UL << uiCounterBits;
+	m_uiCallbackCount	= 0;
+	m_uiHead			= NO_TIMER_SLOT;
+	m_ulBase			= 0;
+	m_ulOverflows		= 0;
+	m_ulEpoch			= 0;
+	m_ulLastTicks		= 0;
+	m_bRunning			= false;
+	m_bClock			= false;
+	m_bInService		= false;
+	m_pServiceHook		= NULL;
+	for ( uint8_t i = 0; i < MAX_CALLBACKS; i++ )
+	{
+		m_aTimers [ i ].bInUse		= false;
+		m_aTimers [ i ].bLinked		= false;
+		m_aTimers [ i ].uiSequence	= 0;
+	}
+}
 
-	// turn on CTC mode
-	TCCR2A |= ( 1 << WGM21 );
-	// Set CS21 bit & CS20 bit for 64 prescaler
-	//TCCR2B |= ( 1 << CS21 );
-	// TCCR2B |= ( 1 << CS20 );
-	// enable timer compare interrupt
-	TIMSK2 |= ( 1 << OCIE2A );
+// Hardware is configured when the first callback is added, as the Arduino core init() reprograms the timers after global constructors have run.
+// Called with interrupts disabled
+void TimerClass::Start ( void )
+{
+	m_ulOverflows = 0;
+	m_ulEpoch = 0;
+	m_ulLastTicks = 0;
+	m_ulBase = 0;
+	HardwareStart ();
+	m_bRunning = true;
+}
 
-	interrupts ();
+// Called with interrupts disabled, no callbacks registered and not used as a clock so no need for the timer to run at all
+void TimerClass::Stop ( void )
+{
+	HardwareStop ();
+	m_bRunning = false;
 }
 
-bool TimerClass::AddCallBack ( TimerCallback Routine, uint32_t ulInterval )
+// Called with interrupts disabled. Programs compare register if the head of the queue falls due before the counter next wraps, otherwise
+// leaves it to the overflow interrupt to chain the wait. Returns true if the head is already due and Service needs to be run
+bool TimerClass::Arm ( void )
 {
-	bool bResult = false;
+	bool bDue = false;
 
-	if ( m_uiCallbackCount < MAX_CALLBACKS )
+	if ( m_uiHead == NO_TIMER_SLOT )
+	{
+		if ( m_bClock )
+		{
+			ClearCompare ();
+		}
+		else
+		{
+			Stop ();
+		}
+	}
+	else
 	{
-		// check callback not already registered
-		for ( uint8_t i = 0; i < m_uiCallbackCount; i++ )
+		uint32_t ulNow = Now ();
+		int32_t lRemaining = ( int32_t ) ( m_ulBase + m_aTimers [ m_uiHead ].ulDelta - ulNow );
+
+		if ( lRemaining <= 0 )
+		{
+			bDue = true;
+		}
+		else if ( ( uint32_t ) lRemaining < m_ulCounterRange )
 		{
-			// look for match
-			if ( m_aFunctions [ i ] == Routine )
+			SetCompare ( ulNow + lRemaining );
+			// counter may have reached deadline while compare was being written, in which case the match has been missed
+			if ( IsDue ( Now (), ulNow + lRemaining ) )
 			{
-				// already here, so quit
-				return bResult;
+				bDue = true;
 			}
 		}
-		m_aFunctions [ m_uiCallbackCount ] = Routine;
-		m_aFunctionIntervals [ m_uiCallbackCount ] = ulInterval;
-		m_uiCallbackCount++;
+		else
+		{
+			ClearCompare ();
+		}
+	}
+	return bDue;
+}
 
-		bResult = true;
+// Called with interrupts disabled. The 32 bit count wraps every 76 hours for Timer2, each time it is seen to go backwards another epoch has passed
+uint64_t TimerClass::Extend ( uint32_t ulNow )
+{
+	if ( ulNow < m_ulLastTicks )
+	{
+		m_ulEpoch++;
 	}
-	return bResult;
+	m_ulLastTicks = ulNow;
+	return ( ( uint64_t ) m_ulEpoch << 32 ) | ulNow;
 }
 
-bool TimerClass::RemoveCallBack ( TimerCallback Routine )
+// Called with interrupts disabled after queue changes outside of Service
+void TimerClass::Reschedule ( void )
 {
-	bool bResult = false;
-	if ( m_uiCallbackCount > 0 )
+	if ( !m_bInService && Arm () )
 	{
-		for ( uint16_t i = 0; i < m_uiCallbackCount; i++ )
+		Service ();
+	}
+}
+
+TimerHandle TimerClass::AddTimer ( TimerCallback Routine, uint32_t ulInterval, eTimerType Type )
+{
+	return AddEntry ( Routine, NULL, NULL, ulInterval, Type );
+}
+
+TimerHandle TimerClass::AddTimer ( TimerContextCallback Routine, void* pContext, uint32_t ulInterval, eTimerType Type )
+{
+	return AddEntry ( NULL, Routine, pContext, ulInterval, Type );
+}
+
+TimerHandle TimerClass::AddEntry ( TimerCallback pCallback, TimerContextCallback pContextCallback, void* pContext, uint32_t ulInterval, eTimerType Type )
+{
+	TimerHandle hResult = INVALID_TIMER;
+
+	if ( pCallback != NULL || pContextCallback != NULL )
+	{
+		uint8_t uiSREG = SREG;
+		noInterrupts ();
+		PROFILE_CRITICAL_START ();
+		for ( uint8_t i = 0; i < MAX_CALLBACKS; i++ )
 		{
-			// look for match
-			if ( m_aFunctions [ i ] == Routine )
+			if ( !m_aTimers [ i ].bInUse )
 			{
-				// match found
-				// overwrite with last entry
-				noInterrupts ();
-				m_aFunctions [ i ] = m_aFunctions [ m_uiCallbackCount ];
-				m_aFunctionIntervals [ i ] = m_aFunctionIntervals [ m_uiCallbackCount ];
-				m_uiCallbackCount--;
-				interrupts ();
-				bResult = true;
+				if ( !m_bRunning )
+				{
+					Start ();
+				}
+				else if ( m_uiHead == NO_TIMER_SLOT )
+				{
+					// clock has been running with nothing queued, bring base up to date so the delay can't exceed the counter wrap
+					m_ulBase = Now ();
+				}
+				m_aTimers [ i ].bHasContext	= pContextCallback != NULL;
+				if ( m_aTimers [ i ].bHasContext )
+				{
+					m_aTimers [ i ].pContextCallback = pContextCallback;
+				}
+				else
+				{
+					m_aTimers [ i ].pCallback = pCallback;
+				}
+				m_aTimers [ i ].pContext	= pContext;
+				m_aTimers [ i ].ulInterval	= ulInterval == 0 ? 1 : ulInterval;
+				m_aTimers [ i ].uiType		= Type;
+				m_aTimers [ i ].bInUse		= true;
+				// queue is measured from m_ulBase, not now
+				Link ( i, ( Now () - m_ulBase ) + m_aTimers [ i ].ulInterval );
+				m_uiCallbackCount++;
+				hResult = MakeHandle ( i );
+				Reschedule ();
 				break;
 			}
 		}
+		PROFILE_CRITICAL_END ();
+		SREG = uiSREG;
+		PROFILE_CRITICAL_RECORD ( uiSREG );
 	}
+	return hResult;
+}
+
+bool TimerClass::RemoveTimer ( TimerHandle hTimer )
+{
+	bool bResult = false;
+
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	int8_t iSlot = FindSlot ( hTimer );
+	if ( iSlot >= 0 )
+	{
+		// if callback is currently running it is not in the queue and won't be relinked once released
+		if ( m_aTimers [ iSlot ].bLinked )
+		{
+			Unlink ( iSlot );
+		}
+		m_aTimers [ iSlot ].bInUse = false;
+		m_aTimers [ iSlot ].uiSequence = ( m_aTimers [ iSlot ].uiSequence + 1 ) % SEQUENCE_LIMIT;
+		m_uiCallbackCount--;
+		Reschedule ();
+		bResult = true;
+	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
 	return bResult;
 }
 
-uint32_t TimerClass::GetInterval ( uint8_t uiIndex )
+// Only the reload value changes, a timer already in the queue keeps its deadline. A periodic callback relinks with the new value when it returns
+bool TimerClass::SetInterval ( TimerHandle hTimer, uint32_t ulInterval )
 {
-	return m_aFunctionIntervals [ uiIndex ];
+	bool bResult = false;
+
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	int8_t iSlot = FindSlot ( hTimer );
+	if ( iSlot >= 0 )
+	{
+		m_aTimers [ iSlot ].ulInterval = ulInterval == 0 ? 1 : ulInterval;
+		bResult = true;
+	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return bResult;
 }
 
-TimerCallback	TimerClass::GetCallback ( uint8_t uiIndex )
+bool TimerClass::IsActive ( TimerHandle hTimer )
 {
-	return m_aFunctions [ uiIndex ];
+	return FindSlot ( hTimer ) >= 0;
+}
+
+bool TimerClass::AddCallBack ( TimerCallback Routine, uint32_t ulInterval )
+{
+	bool bResult = false;
+
+	// check callback not already registered
+	for ( uint8_t i = 0; i < MAX_CALLBACKS; i++ )
+	{
+		// look for match
+		if ( m_aTimers [ i ].bInUse && !m_aTimers [ i ].bHasContext && m_aTimers [ i ].pCallback == Routine )
+		{
+			// already here, so quit
+			return bResult;
+		}
+	}
+	bResult = AddTimer ( Routine, ulInterval ) != INVALID_TIMER;
+
+	return bResult;
+}
+
+bool TimerClass::RemoveCallBack ( TimerCallback Routine )
+{
+	bool bResult = false;
+
+	for ( uint8_t i = 0; i < MAX_CALLBACKS; i++ )
+	{
+		// look for match
+		if ( m_aTimers [ i ].bInUse && !m_aTimers [ i ].bHasContext && m_aTimers [ i ].pCallback == Routine )
+		{
+			bResult = RemoveTimer ( MakeHandle ( i ) );
+			break;
+		}
+	}
+	return bResult;
 }
 
 void TimerClass::ClearAllCallBacks ( void )
 {
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	for ( uint8_t i = 0; i < MAX_CALLBACKS; i++ )
+	{
+		if ( m_aTimers [ i ].bInUse )
+		{
+			m_aTimers [ i ].bInUse = false;
+			m_aTimers [ i ].bLinked = false;
+			m_aTimers [ i ].uiSequence = ( m_aTimers [ i ].uiSequence + 1 ) % SEQUENCE_LIMIT;
+		}
+	}
+	m_uiHead = NO_TIMER_SLOT;
 	m_uiCallbackCount = 0;
+	Reschedule ();
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
 }
 
 uint8_t TimerClass::GetNumCallbacks ( void )
@@ -105,23 +293,361 @@ uint8_t TimerClass::GetNumCallbacks ( void )
 	return m_uiCallbackCount;
 }
 
-// Interrupt routine called by system timer
-//ISR ( TIMER1_OVF_vect )
-ISR ( TIMER2_COMPA_vect )
+uint32_t TimerClass::GetResolution ( void )
+{
+	return m_ulResolution;
+}
+
+uint64_t TimerClass::GetTicks ( void )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	if ( !m_bRunning )
+	{
+		Start ();
+	}
+	m_bClock = true;
+	uint64_t ullResult = Extend ( Now () );
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return ullResult;
+}
+
+uint64_t TimerClass::SecsToTicks ( uint32_t ulSecs )
+{
+	return ( uint64_t ) ulSecs * m_ulResolution;
+}
+
+uint32_t TimerClass::TicksToSecs ( uint64_t ullTicks )
+{
+	uint32_t ulResult;
+
+	// 64 bit division is slow on AVR, intervals under 76 hours don't need it
+	if ( ( ullTicks >> 32 ) == 0 )
+	{
+		ulResult = ( uint32_t ) ullTicks / m_ulResolution;
+	}
+	else
+	{
+		ulResult = ( uint32_t ) ( ullTicks / m_ulResolution );
+	}
+	return ulResult;
+}
+
+uint32_t TimerClass::ElapsedSecs ( uint64_t ullSince )
+{
+	return TicksToSecs ( GetTicks () - ullSince );
+}
+
+bool TimerClass::IsDue ( uint32_t ulNow, uint32_t ulDeadline )
+{
+	// valid while deadlines are less than 2^31 ticks away
+	return ( int32_t ) ( ulNow - ulDeadline ) >= 0;
+}
+
+// Called with interrupts disabled. Walks queue until the cumulative delay is passed and inserts slot there, adjusting the following entry
+void TimerClass::Link ( uint8_t uiSlot, uint32_t ulDelay )
 {
-	static uint32_t ulCount = 0;
-	uint8_t uiNumCallbacks = TheTimer.GetNumCallbacks ();
+	uint8_t uiPrev = NO_TIMER_SLOT;
+	uint8_t uiCur = m_uiHead;
 
-	for ( uint8_t i = 0; i < uiNumCallbacks; i++ )
+	// entries with equal deadlines fire in the order they were added
+	while ( uiCur != NO_TIMER_SLOT && m_aTimers [ uiCur ].ulDelta <= ulDelay )
 	{
-		if ( ( ulCount % TheTimer.GetInterval ( i ) ) == 0 )
+		ulDelay -= m_aTimers [ uiCur ].ulDelta;
+		uiPrev = uiCur;
+		uiCur = m_aTimers [ uiCur ].uiNext;
+	}
+	m_aTimers [ uiSlot ].ulDelta = ulDelay;
+	m_aTimers [ uiSlot ].uiNext = uiCur;
+	m_aTimers [ uiSlot ].bLinked = true;
+	if ( uiCur != NO_TIMER_SLOT )
+	{
+		m_aTimers [ uiCur ].ulDelta -= ulDelay;
+	}
+	if ( uiPrev == NO_TIMER_SLOT )
+	{
+		m_uiHead = uiSlot;
+	}
+	else
+	{
+		m_aTimers [ uiPrev ].uiNext = uiSlot;
+	}
+}
+
+// Called with interrupts disabled. Hands the slot's remaining delay on to its successor so later deadlines are unchanged
+void TimerClass::Unlink ( uint8_t uiSlot )
+{
+	uint8_t uiPrev = NO_TIMER_SLOT;
+	uint8_t uiCur = m_uiHead;
+
+	while ( uiCur != NO_TIMER_SLOT && uiCur != uiSlot )
+	{
+		uiPrev = uiCur;
+		uiCur = m_aTimers [ uiCur ].uiNext;
+	}
+	if ( uiCur != NO_TIMER_SLOT )
+	{
+		uint8_t uiNext = m_aTimers [ uiSlot ].uiNext;
+		if ( uiNext != NO_TIMER_SLOT )
+		{
+			m_aTimers [ uiNext ].ulDelta += m_aTimers [ uiSlot ].ulDelta;
+		}
+		if ( uiPrev == NO_TIMER_SLOT )
+		{
+			m_uiHead = uiNext;
+		}
+		else
+		{
+			m_aTimers [ uiPrev ].uiNext = uiNext;
+		}
+	}
+	m_aTimers [ uiSlot ].bLinked = false;
+}
+
+int8_t TimerClass::FindSlot ( TimerHandle hTimer )
+{
+	int8_t iResult = -1;
+	uint8_t uiSlot = hTimer & SLOT_MASK;
+
+	if ( hTimer != INVALID_TIMER && uiSlot < MAX_CALLBACKS )
+	{
+		if ( m_aTimers [ uiSlot ].bInUse && m_aTimers [ uiSlot ].uiSequence == ( hTimer >> 4 ) )
+		{
+			iResult = uiSlot;
+		}
+	}
+	return iResult;
+}
+
+TimerHandle TimerClass::MakeHandle ( uint8_t uiSlot )
+{
+	return ( m_aTimers [ uiSlot ].uiSequence << 4 ) | uiSlot;
+}
+
+// Runs in interrupt context. Consumes the ticks elapsed since the last service from the queue, firing every entry that has become due, then
+// programs the compare register for the next one
+void TimerClass::Service ( void )
+{
+	m_bInService = true;
+	do
+	{
+		uint32_t ulNow = Now ();
+		uint32_t ulElapsed = ulNow - m_ulBase;
+
+		while ( m_uiHead != NO_TIMER_SLOT && m_aTimers [ m_uiHead ].ulDelta <= ulElapsed )
 		{
-			TheTimer.GetCallback ( i ) ();
+			uint8_t			uiSlot		= m_uiHead;
+			TIMER_ENTRY*	pEntry		= &m_aTimers [ uiSlot ];
+			TimerHandle		hTimer		= MakeHandle ( uiSlot );
+			// take copies as a one shot's slot may be reused by its own callback
+			TimerCallback			pCallback			= pEntry->pCallback;
+			TimerContextCallback	pContextCallback	= pEntry->pContextCallback;
+			void*					pContext			= pEntry->pContext;
+			bool					bHasContext			= pEntry->bHasContext;
+
+			// move base up to this entry's deadline so periodic timers are relinked without drift
+			ulElapsed -= pEntry->ulDelta;
+			m_ulBase += pEntry->ulDelta;
+			m_uiHead = pEntry->uiNext;
+			pEntry->bLinked = false;
+			if ( pEntry->uiType == ONE_SHOT )
+			{
+				// release before calling so callback can reschedule itself
+				RemoveTimer ( hTimer );
+			}
+			if ( bHasContext )
+			{
+				pContextCallback ( pContext );
+			}
+			else
+			{
+				pCallback ();
+			}
+			// relink unless callback cancelled this timer (or cancelled and re-added into the same slot)
+			if ( pEntry->uiType == PERIODIC && FindSlot ( hTimer ) >= 0 && !pEntry->bLinked )
+			{
+				Link ( uiSlot, pEntry->ulInterval );
+			}
 		}
+		if ( m_uiHead != NO_TIMER_SLOT )
+		{
+			m_aTimers [ m_uiHead ].ulDelta -= ulElapsed;
+		}
+		m_ulBase = ulNow;
+		if ( m_pServiceHook != NULL )
+		{
+			m_pServiceHook ();
+		}
+	} while ( Arm () );
+	m_bInService = false;
+}
+
+// The hook lets callbacks that are due together save up their work, eg port writes, and finish it in one go
+void TimerClass::SetServiceHook ( TimerCallback Routine )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	m_pServiceHook = Routine;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+}
+
+// Runs in interrupt context each time the counter wraps, extends the count and arms compare once the next deadline is in range
+void TimerClass::Overflow ( void )
+{
+	m_ulOverflows++;
+	Extend ( Now () );
+	if ( Arm () )
+	{
+		Service ();
+	}
+}
+
+/*
+*	This code is designed for Arduino Uno only!!!!
+*
+*/
+Timer2Class::Timer2Class ( void ) : TimerClass ( RESOLUTION, 8 )
+{
+}
+
+uint32_t Timer2Class::MicrosToTicks ( uint32_t ulMicros )
+{
+	// round to nearest 64us tick
+	return ( ulMicros + 32 ) >> 6;
+}
+
+void Timer2Class::HardwareStart ( void )
+{
+	TCCR2A = 0;				// normal mode, counter free runs 0 - 255
+	TCCR2B = 0;				// stopped while we set up
+	TCNT2 = 0;				//initialize counter value to 0
+
+	// clear any stale flags and enable overflow interrupt, compare interrupt is enabled by Arm when a deadline is in range
+	TIFR2 = ( 1 << OCF2A ) | ( 1 << OCF2B ) | ( 1 << TOV2 );
+	TIMSK2 = ( 1 << TOIE2 );
+
+	// Set CS22, CS21 & CS20 bits for 1024 prescaler
+	TCCR2B = ( 1 << CS22 ) | ( 1 << CS21 ) | ( 1 << CS20 );
+}
+
+void Timer2Class::HardwareStop ( void )
+{
+	TCCR2B = 0;
+	TIMSK2 = 0;
+}
+
+uint32_t Timer2Class::Now ( void )
+{
+	uint8_t		uiCount		= TCNT2;
+	uint32_t	ulOverflows = m_ulOverflows;
+
+	// counter may have wrapped without overflow interrupt having run yet
+	if ( ( TIFR2 & ( 1 << TOV2 ) ) && uiCount < 128 )
+	{
+		ulOverflows++;
+	}
+	return ( ulOverflows << 8 ) | uiCount;
+}
+
+void Timer2Class::SetCompare ( uint32_t ulDeadline )
+{
+	OCR2A = ( uint8_t ) ulDeadline;
+	TIFR2 = ( 1 << OCF2A );
+	TIMSK2 |= ( 1 << OCIE2A );
+}
+
+void Timer2Class::ClearCompare ( void )
+{
+	TIMSK2 &= ~( 1 << OCIE2A );
+}
+
+Timer1Class::Timer1Class ( void ) : TimerClass ( STEP_RESOLUTION, 16 )
+{
+}
+
+uint32_t Timer1Class::MicrosToTicks ( uint32_t ulMicros )
+{
+	return ulMicros << 1;
+}
+
+void Timer1Class::HardwareStart ( void )
+{
+	TCCR1B = 0;				// stopped while we set up
+	TCCR1A &= ~( ( 1 << COM1A1 ) | ( 1 << COM1A0 ) | ( 1 << WGM11 ) | ( 1 << WGM10 ) );	// normal mode, counter free runs 0 - 65535, channel B left to StepDirMotorClass
+	TCNT1 = 0;
+
+	TIFR1 = ( 1 << OCF1A ) | ( 1 << TOV1 );
+	TIMSK1 = ( TIMSK1 & ( 1 << OCIE1B ) ) | ( 1 << TOIE1 );
+
+	// Set CS11 bit for 8 prescaler
+	TCCR1B = ( 1 << CS11 );
+}
+
+void Timer1Class::HardwareStop ( void )
+{
+	TCCR1B = 0;
+	TIMSK1 &= ~( ( 1 << OCIE1A ) | ( 1 << TOIE1 ) );
+}
+
+uint32_t Timer1Class::Now ( void )
+{
+	uint16_t	uiCount		= TCNT1;
+	uint32_t	ulOverflows = m_ulOverflows;
+
+	if ( ( TIFR1 & ( 1 << TOV1 ) ) && uiCount < 32768 )
+	{
+		ulOverflows++;
 	}
-	ulCount++;
-	TCNT2 = 0;		// Shouldn't be necessary!
+	return ( ulOverflows << 16 ) | uiCount;
+}
+
+void Timer1Class::SetCompare ( uint32_t ulDeadline )
+{
+	OCR1A = ( uint16_t ) ulDeadline;
+	TIFR1 = ( 1 << OCF1A );
+	TIMSK1 |= ( 1 << OCIE1A );
 }
 
-TimerClass TheTimer;
+void Timer1Class::ClearCompare ( void )
+{
+	TIMSK1 &= ~( 1 << OCIE1A );
+}
+
+// Interrupt routines called by hardware timers
+ISR ( TIMER2_COMPA_vect )
+{
+	PROFILE_ISR_START ();
+	TheTimer.Service ();
+	PROFILE_ISR_END ( PROFILE_TIMER2_COMPA );
+}
+
+ISR ( TIMER2_OVF_vect )
+{
+	PROFILE_ISR_START ();
+	TheTimer.Overflow ();
+	PROFILE_ISR_END ( PROFILE_TIMER2_OVF );
+}
+
+ISR ( TIMER1_COMPA_vect )
+{
+	PROFILE_ISR_START ();
+	TheStepTimer.Service ();
+	PROFILE_ISR_END ( PROFILE_TIMER1_COMPA );
+}
+
+ISR ( TIMER1_OVF_vect )
+{
+	PROFILE_ISR_START ();
+	TheStepTimer.Overflow ();
+	PROFILE_ISR_END ( PROFILE_TIMER1_OVF );
+}
 
+Timer2Class TheTimer;
+Timer1Class TheStepTimer;
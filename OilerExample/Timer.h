@@ -2,6 +2,26 @@
 //
 // This defines a timer class that encapsulates a microsecond timer that has functions to call at given intervals
 //
+// Callbacks are held in a delta queue ordered by when they are next due, each entry storing the number of ticks after the entry in front of it.
+// The timer is tickless, the hardware counter free runs and its compare register is programmed to the deadline at the head of the queue, waits
+// longer than the counter are chained by counting overflows. When no callbacks are registered the timer is stopped altogether, unless it is being
+// used as a clock.
+//
+// GetTicks returns a 64 bit monotonic tick count built from the free running counter, it never drifts as the counter is never reset and won't
+// wrap in the life of the machine. The 32 bit count is extended by the overflow interrupt so the first call to GetTicks keeps the timer running
+// from then on. Comparisons of 32 bit times must go through IsDue so they stay correct across the wrap.
+//
+// This is a trade-off. Once GetTicks has been called the timer never stops, even with no callbacks, so TheTimer costs an overflow interrupt
+// every 16ms (256 ticks) of a few microseconds, and Timer2 can't be gated off to save power. The tick count could instead be rebuilt on demand
+// after a stop from another clock such as millis, but it would then drift against the callbacks' deadlines and jump when the two clocks
+// disagree. The oiler and machine take times from GetTicks throughout, so the timer would hardly ever stop anyway and a steady clock is kept.
+//
+// TimerClass holds the scheduling, the hardware is provided by a derived class. There are two instances:
+//		TheTimer		Timer2, 64us ticks, used for low rate supervision such as the oiler and machine deadlines, and as the system clock
+//		TheStepTimer	Timer1, 0.5us ticks, used to time motor steps. NB this takes over Timer1 so analogWrite on pins 9 & 10 and the Servo library
+//						can't be used once a stepper motor has been started. Only compare channel A is used, channel B and its pin D10 are left to
+//						StepDirMotorClass
+//
 // (c) Mark Naylor June 2021
 //
 
@@ -14,30 +34,125 @@
 #include "WProgram.h"
 #endif
 #define MAX_CALLBACKS	8
-#define RESOLUTION		2000		// ticks per sec
+#define RESOLUTION		15625		// TheTimer ticks per sec, one tick is 64us (16MHz / 1024 prescaler)
+#define STEP_RESOLUTION	2000000		// TheStepTimer ticks per sec, one tick is 0.5us (16MHz / 8 prescaler)
+#define INVALID_TIMER	0xFF		// returned by AddTimer if callback could not be scheduled
+#define NO_TIMER_SLOT	0xFF		// marks end of delta queue
 
 typedef void ( *TimerCallback )( void );
+typedef void ( *TimerContextCallback )( void* pContext );		// for callbacks that need to know which object they are working for
+typedef uint8_t TimerHandle;		// low nibble is slot index, high nibble is a sequence number so a stale handle cannot cancel a reused slot
 
 class TimerClass
 {
 public:
-	TimerClass ( void );
-	bool		AddCallBack ( TimerCallback Routine, uint32_t uiInterval );
+	enum eTimerType { PERIODIC, ONE_SHOT };
+
+	TimerHandle	AddTimer ( TimerCallback Routine, uint32_t ulInterval, eTimerType Type = PERIODIC );	// interval in ticks, returns INVALID_TIMER if no free slot
+	TimerHandle	AddTimer ( TimerContextCallback Routine, void* pContext, uint32_t ulInterval, eTimerType Type = PERIODIC );	// Routine is passed pContext each time it is called
+	bool		RemoveTimer ( TimerHandle hTimer );													// safe to call from a callback, including on its own handle
+	bool		IsActive ( TimerHandle hTimer );
+	bool		SetInterval ( TimerHandle hTimer, uint32_t ulInterval );							// used from the next time it is scheduled, from its own callback that is the next call
+	bool		AddCallBack ( TimerCallback Routine, uint32_t uiInterval );						// periodic, rejected if Routine already registered
 	bool		RemoveCallBack ( TimerCallback Routine );
-	uint32_t	GetInterval ( uint8_t uiIndex );
-	TimerCallback GetCallback ( uint8_t uiIndex );
 	void		ClearAllCallBacks ( void );
 	uint8_t		GetNumCallbacks ( void );
+	uint32_t	GetResolution ( void );																// ticks per second
+	uint64_t	GetTicks ( void );																	// monotonic ticks since clock started, safe to call from interrupts
+	uint64_t	SecsToTicks ( uint32_t ulSecs );
+	uint32_t	TicksToSecs ( uint64_t ullTicks );
+	uint32_t	ElapsedSecs ( uint64_t ullSince );													// whole seconds from GetTicks value ullSince to now
+	static bool	IsDue ( uint32_t ulNow, uint32_t ulDeadline );										// wrap safe, true if ulNow is at or past ulDeadline
+	void		SetServiceHook ( TimerCallback Routine );											// Routine is run in interrupt context after each batch of callbacks due together, NULL for none
+	virtual uint32_t MicrosToTicks ( uint32_t ulMicros ) = 0;
+	void		Service ( void );																	// called by compare interrupt when head of queue is due
+	void		Overflow ( void );																	// called by overflow interrupt each time the counter wraps
+
+protected:
+				TimerClass ( uint32_t ulResolution, uint8_t uiCounterBits );
+	void		Start ( void );																		// configures and starts timer hardware
+	void		Stop ( void );																		// gates timer off
+	bool		Arm ( void );																		// programs compare register for head of queue, or stops timer if queue empty
+	void		Reschedule ( void );																// rearms after queue changed outside of Service
+	uint64_t	Extend ( uint32_t ulNow );															// widens Now to 64 bits, must be called at least once per wrap
+
+	// hardware specific, all called with interrupts disabled
+	virtual void	 HardwareStart ( void ) = 0;													// normal mode, counter cleared, overflow interrupt on
+	virtual void	 HardwareStop ( void ) = 0;														// counter stopped, all interrupts off
+	virtual uint32_t Now ( void ) = 0;																// ticks since timer started, overflow count combined with counter
+	virtual void	 SetCompare ( uint32_t ulDeadline ) = 0;										// compare interrupt at low bits of deadline
+	virtual void	 ClearCompare ( void ) = 0;														// compare interrupt off
+	void		Link ( uint8_t uiSlot, uint32_t ulDelay );											// insert slot into delta queue, due in ulDelay ticks from m_ulBase
+	void		Unlink ( uint8_t uiSlot );															// remove slot from delta queue
+	TimerHandle	AddEntry ( TimerCallback pCallback, TimerContextCallback pContextCallback, void* pContext, uint32_t ulInterval, eTimerType Type );	// one of the callbacks is NULL
+	int8_t		FindSlot ( TimerHandle hTimer );													// returns -1 if handle not current
+	TimerHandle	MakeHandle ( uint8_t uiSlot );
+
+	typedef struct
+	{
+		union
+		{
+			TimerCallback			pCallback;
+			TimerContextCallback	pContextCallback;
+		};
+		void*			pContext;
+		uint32_t		ulInterval;							// reload value in ticks for periodic timers
+		uint32_t		ulDelta;							// ticks after the preceding entry in the queue expires (after m_ulBase for the head)
+		uint8_t			uiNext;								// next slot in queue or NO_TIMER_SLOT
+		uint8_t			uiType;								// PERIODIC or ONE_SHOT
+		uint8_t			uiSequence;							// incremented each time slot is reused
+		bool			bHasContext;						// call pContextCallback rather than pCallback
+		bool			bInUse;
+		bool			bLinked;							// true when in delta queue, false while its callback is running
+	} TIMER_ENTRY;
 
+	TIMER_ENTRY			m_aTimers [ MAX_CALLBACKS ];
+	volatile uint8_t	m_uiHead;							// slot due next
+	uint8_t				m_uiCallbackCount;
+	uint32_t			m_ulBase;							// time the head entry's delta is measured from
+	volatile uint32_t	m_ulOverflows;						// upper bits of the tick count
+	uint32_t			m_ulEpoch;							// number of times the 32 bit tick count has wrapped
+	uint32_t			m_ulLastTicks;						// tick count when last extended, a lower value means it has wrapped
+	TimerCallback		m_pServiceHook;
+	uint32_t			m_ulResolution;
+	uint32_t			m_ulCounterRange;					// ticks between overflows
+	bool				m_bRunning;
+	bool				m_bClock;							// GetTicks has been used, keep running with an empty queue, never cleared, see above
+	bool				m_bInService;						// set while callbacks are being run, defers rearming to the end of Service
+};
 
+// Timer2, 8 bit counter with 1024 prescaler
+class Timer2Class : public TimerClass
+{
+public:
+				Timer2Class ( void );
+	uint32_t	MicrosToTicks ( uint32_t ulMicros );
+
+protected:
+	void		HardwareStart ( void );
+	void		HardwareStop ( void );
+	uint32_t	Now ( void );
+	void		SetCompare ( uint32_t ulDeadline );
+	void		ClearCompare ( void );
+};
+
+// Timer1, 16 bit counter with 8 prescaler
+class Timer1Class : public TimerClass
+{
+public:
+				Timer1Class ( void );
+	uint32_t	MicrosToTicks ( uint32_t ulMicros );
 
 protected:
-	uint8_t			m_uiCallbackCount;
-	TimerCallback	m_aFunctions [ MAX_CALLBACKS ];
-	uint32_t		m_aFunctionIntervals [ MAX_CALLBACKS ];
+	void		HardwareStart ( void );
+	void		HardwareStop ( void );
+	uint32_t	Now ( void );
+	void		SetCompare ( uint32_t ulDeadline );
+	void		ClearCompare ( void );
 };
 
-extern TimerClass TheTimer;
+extern Timer2Class TheTimer;
+extern Timer1Class TheStepTimer;
 
 #endif
 
@@ -0,0 +1,90 @@
+//
+//  WorkQueue.cpp
+// 
+// (c) Mark Naylor June 2021
+//
+//	Implements a bounded queue of deferred work, written to by interrupt routines and drained from the sketch loop
+//
+
+#include "WorkQueue.h"
+#include "Profiler.h"
+
+#define		QUEUE_MASK		( WORK_QUEUE_SIZE - 1 )
+
+WorkQueueClass::WorkQueueClass ( void )
+{
+	m_uiHead		= 0;
+	m_uiTail		= 0;
+	m_uiOverflows	= 0;
+	m_uiHighWater	= 0;
+}
+
+bool WorkQueueClass::Post ( WorkHandler pHandler, uint8_t uiParam )
+{
+	bool bResult = false;
+
+	// several interrupt routines as well as loop can post, so claim the slot with interrupts off
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	uint8_t uiNext = ( m_uiHead + 1 ) & QUEUE_MASK;
+	if ( uiNext != m_uiTail )
+	{
+		m_aItems [ m_uiHead ].pHandler	= pHandler;
+		m_aItems [ m_uiHead ].uiParam	= uiParam;
+		m_uiHead = uiNext;
+
+		uint8_t uiWaiting = ( m_uiHead - m_uiTail ) & QUEUE_MASK;
+		if ( uiWaiting > m_uiHighWater )
+		{
+			m_uiHighWater = uiWaiting;
+		}
+		bResult = true;
+	}
+	else
+	{
+		m_uiOverflows++;
+	}
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return bResult;
+}
+
+// Only the loop consumes, so the tail needs no locking. At most one queue's worth of items is run so loop is not starved by a busy interrupt
+uint8_t WorkQueueClass::Dispatch ( void )
+{
+	uint8_t uiCount = 0;
+
+	while ( m_uiTail != m_uiHead && uiCount < WORK_QUEUE_SIZE )
+	{
+		WorkHandler	pHandler	= m_aItems [ m_uiTail ].pHandler;
+		uint8_t		uiParam		= m_aItems [ m_uiTail ].uiParam;
+
+		m_uiTail = ( m_uiTail + 1 ) & QUEUE_MASK;
+		pHandler ( uiParam );
+		uiCount++;
+	}
+	return uiCount;
+}
+
+uint16_t WorkQueueClass::GetOverflows ( void )
+{
+	uint8_t uiSREG = SREG;
+	noInterrupts ();
+	PROFILE_CRITICAL_START ();
+	uint16_t uiResult = m_uiOverflows;
+	PROFILE_CRITICAL_END ();
+	SREG = uiSREG;
+	PROFILE_CRITICAL_RECORD ( uiSREG );
+
+	return uiResult;
+}
+
+uint8_t WorkQueueClass::GetHighWater ( void )
+{
+	return m_uiHighWater;
+}
+
+WorkQueueClass TheWorkQueue;
@@ -0,0 +1,49 @@
+//
+//  WorkQueue.h
+// 
+// (c) Mark Naylor June 2021
+//
+//	This class implements a bounded queue of deferred work. Interrupt routines post a small record naming the routine to run and a one byte parameter,
+//	the work itself is run later outside of interrupt context when the sketch calls Dispatch from its loop function.
+//	Posting has a fixed cost regardless of what the work does, so interrupts are only disabled for a short and predictable time.
+//
+#ifndef _WORKQUEUE_h
+#define _WORKQUEUE_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+	#include <Arduino.h>
+#else
+	#include "WProgram.h"
+#endif
+
+#define		WORK_QUEUE_SIZE		16									// must be a power of 2
+
+typedef void ( *WorkHandler )( uint8_t uiParam );
+
+class WorkQueueClass
+{
+public:
+						WorkQueueClass ( void );
+	bool				Post ( WorkHandler pHandler, uint8_t uiParam = 0 );	// safe from interrupts and loop, returns false if queue full
+	uint8_t				Dispatch ( void );									// runs queued work, call from loop, returns number of items run
+	uint16_t			GetOverflows ( void );								// number of items lost because queue was full
+	uint8_t				GetHighWater ( void );								// most items ever waiting
+
+protected:
+	typedef struct
+	{
+		WorkHandler			pHandler;
+		uint8_t				uiParam;
+	} WORK_ITEM;
+
+	volatile WORK_ITEM	m_aItems [ WORK_QUEUE_SIZE ];
+	volatile uint8_t	m_uiHead;											// next free slot, written by producers
+	volatile uint8_t	m_uiTail;											// next item to run, written by Dispatch only
+	volatile uint16_t	m_uiOverflows;
+	uint8_t				m_uiHighWater;
+};
+
+extern WorkQueueClass TheWorkQueue;
+
+#endif
+